@@ -0,0 +1,21 @@
+#!/bin/sh
+# Headless Linux build: libgl3d.so with the EGL backend, testbench linked against it and a short smoke run
+# Needs g++ with C++17 and EGL & GLVND OpenGL libraries, Mesa llvmpipe is enough
+set -e
+
+ROOT=$(cd "$(dirname "$0")" && pwd)
+OUT=${1:-"$ROOT/build/linux"}
+CXX=${CXX:-g++}
+
+mkdir -p "$OUT"
+
+"$CXX" -std=c++17 -O2 -fPIC -shared -fvisibility=hidden \
+	-DGL3D_IMPLEMENTATION -DGL3D_DYNAMIC -DGL3D_BUILDING \
+	"$ROOT/src/gl3d/gl3d.cpp" -o "$OUT/libgl3d.so" -lEGL -lOpenGL -pthread
+
+"$CXX" -std=c++17 -O2 -I"$ROOT/src" \
+	"$ROOT/tests/testbench/Main.cpp" -o "$OUT/testbench" -L"$OUT" -lgl3d -Wl,-rpath,'$ORIGIN' -pthread
+
+# Renders a few frames into a pbuffer, testbench mounts ../../data relative to the working directory
+cd "$OUT"
+./testbench --frames 10
@@ -1,6 +1,7 @@
 #ifndef __GL3D_H__
 #define __GL3D_H__
 
+#include <future>
 #include <initializer_list>
 #include <vector>
 #include <memory>
@@ -15,6 +16,12 @@
 		static gl3d::detail::layout l { __VA_ARGS__ }; \
 		return l; }
 
+#define GL3D_BLOCK_LAYOUT(_Packing, _BlockName, ...) \
+	static const gl3d::detail::block_layout &block_layout() { \
+		static gl3d::detail::block_layout l { gl3d::block_packing::_Packing, _BlockName, __VA_ARGS__ }; \
+		return l; } \
+	inline static const gl3d::detail::block_layout &registered_block_layout = block_layout();
+
 namespace gl3d {
 
 namespace detail {
@@ -34,6 +41,7 @@ struct gl_api
 	GL_PROC(     void, BlendFunci, unsigned, gl_enum, gl_enum )
 	GL_PROC(     void, BlendEquationi, unsigned, gl_enum )
 	GL_PROC(     void, GetIntegerv, gl_enum, int *)
+	GL_PROC(const char *, GetStringi, gl_enum, unsigned)
 
 	/// Shaders and programs
 	GL_PROC(unsigned, CreateShader, gl_enum)
@@ -50,6 +58,14 @@ struct gl_api
 	GL_PROC(    void, LinkProgram, unsigned)
 	GL_PROC(    void, UseProgram, unsigned)
 	GL_PROC(    void, GetProgramiv, unsigned, gl_enum, int *)
+	GL_PROC(    void, ProgramParameteri, unsigned, gl_enum, int)
+	GL_PROC(    void, GetProgramBinary, unsigned, int, int *, unsigned *, void *)
+	GL_PROC(    void, ProgramBinary, unsigned, unsigned, const void *, int)
+	GL_PROC(    void, MaxShaderCompilerThreadsKHR, unsigned)
+	GL_PROC(    void, GetProgramInterfaceiv, unsigned, gl_enum, gl_enum, int *)
+	GL_PROC(unsigned, GetProgramResourceIndex, unsigned, gl_enum, const char *)
+	GL_PROC(    void, GetProgramResourceName, unsigned, gl_enum, unsigned, int, int *, char *)
+	GL_PROC(    void, GetProgramResourceiv, unsigned, gl_enum, unsigned, int, const gl_enum *, int, int *, int *)
 
 	/// Uniforms
 	GL_PROC( int, GetUniformLocation, unsigned, const char *)
@@ -58,6 +74,7 @@ struct gl_api
 	GL_PROC(void, Uniform2fv, int, unsigned, const float *)
 	GL_PROC(void, Uniform3fv, int, unsigned, const float *)
 	GL_PROC(void, Uniform3uiv, int, unsigned, const unsigned *)
+	GL_PROC(void, Uniform4uiv, int, unsigned, const unsigned *)
 	GL_PROC(void, Uniform4iv, int, unsigned, const int *)
 	GL_PROC(void, Uniform4fv, int, unsigned, const float *)
 	GL_PROC(void, UniformMatrix3fv, int, unsigned, unsigned char, const float *)
@@ -76,6 +93,7 @@ struct gl_api
 	GL_PROC(   void, FlushMappedNamedBufferRange, unsigned, ptrdiff_t, unsigned)
 	GL_PROC(   void, BindBuffer, gl_enum, unsigned)
 	GL_PROC(   void, BindBufferRange, gl_enum, unsigned, unsigned, ptrdiff_t, size_t)
+	GL_PROC(   void, BindBufferBase, gl_enum, unsigned, unsigned)
 
 	/// Vertex array objects
 	GL_PROC(void, CreateVertexArrays, unsigned, unsigned *)
@@ -91,15 +109,30 @@ struct gl_api
 
 	/// Textures
 	GL_PROC(    void, CreateTextures, gl_enum, unsigned, unsigned *)
+	GL_PROC(    void, DeleteTextures, unsigned, const unsigned *)
 	GL_PROC(    void, TextureParameteri, unsigned, gl_enum, int)
 	GL_PROC(    void, TextureParameterf, unsigned, gl_enum, float)
+	GL_PROC(    void, TextureStorage1D, unsigned, unsigned, gl_internal_format, unsigned)
 	GL_PROC(    void, TextureStorage2D, unsigned, unsigned, gl_internal_format, unsigned, unsigned)
+	GL_PROC(    void, TextureSubImage1D, unsigned, int, int, unsigned, gl_format, gl_type, const void *)
 	GL_PROC(    void, TextureSubImage2D, unsigned, int, int, int, unsigned, unsigned, gl_format, gl_type, const void *)
+	GL_PROC(    void, TextureSubImage3D, unsigned, int, int, int, int, unsigned, unsigned, unsigned, gl_format, gl_type, const void *)
+	GL_PROC(    void, CompressedTextureSubImage2D, unsigned, int, int, int, unsigned, unsigned, gl_internal_format, int, const void *)
 	GL_PROC(    void, BindTextureUnit, unsigned, unsigned)
+	GL_PROC(    void, BindImageTexture, unsigned, unsigned, int, unsigned char, int, gl_enum, gl_internal_format)
 	GL_PROC(uint64_t, GetTextureHandleARB, unsigned)
 	GL_PROC(    void, MakeTextureHandleResidentARB, uint64_t)
 	GL_PROC(    void, MakeTextureHandleNonResidentARB, uint64_t)
 	GL_PROC(    void, GenerateTextureMipmap, unsigned)
+	GL_PROC(    void, GetTextureSubImage, unsigned, int, int, int, int, unsigned, unsigned, unsigned, gl_format, gl_type, int, void *)
+
+	/// Samplers
+	GL_PROC(    void, CreateSamplers, unsigned, unsigned *)
+	GL_PROC(    void, DeleteSamplers, unsigned, const unsigned *)
+	GL_PROC(    void, SamplerParameteri, unsigned, gl_enum, int)
+	GL_PROC(    void, SamplerParameterf, unsigned, gl_enum, float)
+	GL_PROC(    void, BindSampler, unsigned, unsigned)
+	GL_PROC(uint64_t, GetTextureSamplerHandleARB, unsigned, unsigned)
 
 	/// Frame buffer objects
 	GL_PROC(   void, CreateFramebuffers, unsigned, unsigned *)
@@ -114,6 +147,23 @@ struct gl_api
 	GL_PROC(void, DrawElementsInstancedBaseInstance, gl_enum, unsigned, gl_type, const void *, unsigned, unsigned)
 	GL_PROC(void, MultiDrawArraysIndirect, gl_enum, const void *, unsigned, unsigned)
 	GL_PROC(void, MultiDrawElementsIndirect, gl_enum, gl_type, const void *, unsigned, unsigned)
+	GL_PROC(void, DispatchCompute, unsigned, unsigned, unsigned)
+	GL_PROC(void, DispatchComputeIndirect, ptrdiff_t)
+	GL_PROC(void, MemoryBarrier, unsigned)
+
+	// Queries & debug groups
+	GL_PROC(void, CreateQueries, gl_enum, int, unsigned *)
+	GL_PROC(void, DeleteQueries, int, const unsigned *)
+	GL_PROC(void, QueryCounter, unsigned, gl_enum)
+	GL_PROC(void, GetQueryObjectiv, unsigned, gl_enum, int *)
+	GL_PROC(void, GetQueryObjectui64v, unsigned, gl_enum, uint64_t *)
+	GL_PROC(void, PushDebugGroup, gl_enum, unsigned, int, const char *)
+	GL_PROC(void, PopDebugGroup)
+
+	// Sync objects
+	GL_PROC( void *, FenceSync, gl_enum, unsigned)
+	GL_PROC(gl_enum, ClientWaitSync, void *, unsigned, uint64_t)
+	GL_PROC(   void, DeleteSync, void *)
 
 	// *INDENT-ON*
 };
@@ -174,6 +224,7 @@ enum class gl_enum : unsigned
 	FRAMEBUFFER = 0x8D40,
 
 	ARRAY_BUFFER = 0x8892, ELEMENT_ARRAY_BUFFER,
+	PIXEL_PACK_BUFFER = 0x88EB, PIXEL_UNPACK_BUFFER,
 
 	STREAM_DRAW = 0x88E0, STREAM_READ, STREAM_COPY,
 	STATIC_DRAW = 0x88E4, STATIC_READ, STATIC_COPY,
@@ -184,6 +235,7 @@ enum class gl_enum : unsigned
 	COMPUTE_SHADER = 0x91B9,
 
 	TEXTURE_MAX_ANISOTROPY = 0x84FE,
+	TEXTURE_MIN_LOD = 0x813A,
 	VERTEX_ARRAY_BINDING = 0x85B5,
 
 	DEPTH_CLAMP = 0x864F,
@@ -195,10 +247,31 @@ enum class gl_enum : unsigned
 
 	COMPILE_STATUS = 0x8B81, LINK_STATUS, VALIDATE_STATUS, INFO_LOG_LENGTH,
 	CURRENT_PROGRAM = 0x8B8D,
+	COMPLETION_STATUS_KHR = 0x91B1,
+	PROGRAM_BINARY_RETRIEVABLE_HINT = 0x8257,
+	PROGRAM_BINARY_LENGTH = 0x8741,
+
+	UNIFORM = 0x92E1, UNIFORM_BLOCK,
+	BUFFER_VARIABLE = 0x92E5, SHADER_STORAGE_BLOCK,
+	ACTIVE_RESOURCES = 0x92F5, MAX_NAME_LENGTH,
+	TYPE = 0x92FA, ARRAY_SIZE, OFFSET, BLOCK_INDEX, ARRAY_STRIDE,
+	BUFFER_BINDING = 0x9302, BUFFER_DATA_SIZE, NUM_ACTIVE_VARIABLES, ACTIVE_VARIABLES,
+
+	QUERY_RESULT = 0x8866, QUERY_RESULT_AVAILABLE,
+	TIMESTAMP = 0x8E28,
+	DEBUG_SOURCE_APPLICATION = 0x824A,
+
+	EXTENSIONS = 0x1F03,
+	NUM_EXTENSIONS = 0x821D,
 
 	DRAW_INDIRECT_BUFFER = 0x8F3F,
+	DISPATCH_INDIRECT_BUFFER = 0x90EE,
 	SHADER_STORAGE_BUFFER = 0x90D2,
 
+	SYNC_GPU_COMMANDS_COMPLETE = 0x9117,
+	SYNC_FLUSH_COMMANDS_BIT = 0x0001,
+	ALREADY_SIGNALED = 0x911A, TIMEOUT_EXPIRED, CONDITION_SATISFIED, WAIT_FAILED,
+
 	MAP_READ_BIT = 0x0001,
 	MAP_WRITE_BIT = 0x0002,
 	MAP_INVALIDATE_RANGE_BIT = 0x0004,
@@ -208,6 +281,12 @@ enum class gl_enum : unsigned
 	DYNAMIC_STORAGE_BIT = 0x0100,
 	CLIENT_STORAGE_BIT = 0x0200,
 
+	VERTEX_ATTRIB_ARRAY_BARRIER_BIT = 0x0001, ELEMENT_ARRAY_BARRIER_BIT = 0x0002, UNIFORM_BARRIER_BIT = 0x0004,
+	TEXTURE_FETCH_BARRIER_BIT = 0x0008, SHADER_IMAGE_ACCESS_BARRIER_BIT = 0x0020, COMMAND_BARRIER_BIT = 0x0040,
+	PIXEL_BUFFER_BARRIER_BIT = 0x0080, TEXTURE_UPDATE_BARRIER_BIT = 0x0100, BUFFER_UPDATE_BARRIER_BIT = 0x0200,
+	FRAMEBUFFER_BARRIER_BIT = 0x0400, ATOMIC_COUNTER_BARRIER_BIT = 0x1000, SHADER_STORAGE_BARRIER_BIT = 0x2000,
+	ALL_BARRIER_BITS = 0xFFFFFFFF,
+
 #if defined(WIN32)
 	CONTEXT_MAJOR_VERSION = 0x2091, CONTEXT_MINOR_VERSION,
 
@@ -225,6 +304,9 @@ enum class gl_internal_format : unsigned
 	NONE = 0,
 	RGB8 = 0x8051,
 	RGBA8 = 0x8058,
+	SRGB8_ALPHA8 = 0x8C43,
+	RGBA16F = 0x881A,
+	RGBA32F = 0x8814,
 
 	R8 = 0x8229, R16, RG8, RG16,
 	R16F, R32F, RG16F, RG32F,
@@ -234,6 +316,11 @@ enum class gl_internal_format : unsigned
 	DEPTH_COMPONENT32F = 0x8CAC,
 	DEPTH24_STENCIL8 = 0x88F0,
 	DEPTH32F_STENCIL8 = 0x8CAD,
+
+	COMPRESSED_RGB_S3TC_DXT1 = 0x83F0, COMPRESSED_RGBA_S3TC_DXT1, COMPRESSED_RGBA_S3TC_DXT3, COMPRESSED_RGBA_S3TC_DXT5,
+	COMPRESSED_RED_RGTC1 = 0x8DBB,
+	COMPRESSED_RG_RGTC2 = 0x8DBD,
+	COMPRESSED_RGBA_BPTC_UNORM = 0x8E8C, COMPRESSED_SRGB_ALPHA_BPTC_UNORM, COMPRESSED_RGB_BPTC_SIGNED_FLOAT, COMPRESSED_RGB_BPTC_UNSIGNED_FLOAT,
 };
 
 GL3D_ENUM_PLUS( gl_internal_format )
@@ -255,7 +342,7 @@ enum class gl_type : unsigned
 	NONE = 0,
 
 	BYTE = 0x1400, UNSIGNED_BYTE, SHORT, UNSIGNED_SHORT, INT, UNSIGNED_INT, FLOAT,
-	DOUBLE = 0x140A,
+	DOUBLE = 0x140A, HALF_FLOAT,
 	UNSIGNED_INT64 = 0x140F,
 
 	FLOAT_VEC2 = 0x8B50, FLOAT_VEC3, FLOAT_VEC4, INT_VEC2, INT_VEC3, INT_VEC4, BOOL,
@@ -292,6 +379,7 @@ private:
 	template <typename T> struct type { };
 
 	void fill( attr &a, unsigned loc, unsigned off, type<int> ) { a = { loc, off, 1, gl_type::INT, true }; }
+	void fill( attr &a, unsigned loc, unsigned off, type<unsigned> ) { a = { loc, off, 1, gl_type::UNSIGNED_INT, true }; }
 	void fill( attr &a, unsigned loc, unsigned off, type<float> ) { a = { loc, off, 1, gl_type::FLOAT, false }; }
 	void fill( attr &a, unsigned loc, unsigned off, type<vec2> ) { a = { loc, off, 2, gl_type::FLOAT, false }; }
 	void fill( attr &a, unsigned loc, unsigned off, type<ivec2> ) { a = { loc, off, 2, gl_type::INT, true }; }
@@ -315,6 +403,99 @@ private:
 	}
 };
 
+// Storage buffer bindings & uniform location reserved for vertex pulling
+static constexpr unsigned vertex_pulling_vb_binding = 15;
+static constexpr unsigned vertex_pulling_ib_binding = 14;
+static constexpr int vertex_pulling_params_location = 1023;
+
+/// @brief Generates GLSL fetching attributes described by the layout from storage buffers
+/// @note Vertex shader calls gl3d_fetch_vertex() and reads attributes from gl3d_attrib<location> variables
+GL3D_API std::string vertex_pulling_source( const layout &l );
+
+} // namespace gl3d::detail
+
+//---------------------------------------------------------------------------------------------------------------------
+enum class block_packing { std140, std430 };
+
+namespace detail {
+
+//---------------------------------------------------------------------------------------------------------------------
+/// @brief Describes C++ struct as std140/std430 block, member offsets are checked against the packing rules
+/// @note There is no mat3 support, its C++ layout can never match column stride of 16 bytes
+struct GL3D_API block_layout
+{
+	struct member
+	{
+		const char *name = nullptr;
+		unsigned offset = 0;
+		unsigned size = 0;         // Size of single element
+		unsigned alignment = 0;    // Base alignment of single element
+		unsigned array_size = 0;   // Zero for non-array members
+		unsigned array_stride = 0; // Stride expected by packing rules
+		gl_type type = gl_type::NONE;
+	};
+
+	block_packing packing;
+	const char *name;
+	std::vector<member> members;
+	unsigned size = 0;
+	bool valid = true;
+
+	template <typename... Args>
+	block_layout( block_packing p, const char *blockName, Args &&... args )
+		: packing( p )
+		, name( blockName )
+		, members( sizeof...( Args ) / 2 )
+	{
+		init( 0, args... );
+		validate();
+		register_layout( this );
+	}
+
+	const member *find( std::string_view memberName ) const;
+
+	/// @brief Checks block described by C++ struct against active block of the same name in linked program
+	/// @return false when any block does not match, shader fails to link then
+	static bool validate_program( unsigned programID );
+
+private:
+	template <typename T> struct type { };
+
+	void fill( member &m, type<int> ) { m.type = gl_type::INT; m.size = m.alignment = 4; }
+	void fill( member &m, type<unsigned> ) { m.type = gl_type::UNSIGNED_INT; m.size = m.alignment = 4; }
+	void fill( member &m, type<float> ) { m.type = gl_type::FLOAT; m.size = m.alignment = 4; }
+	void fill( member &m, type<uint64_t> ) { m.type = gl_type::UNSIGNED_INT64; m.size = m.alignment = 8; }
+	void fill( member &m, type<vec2> ) { m.type = gl_type::FLOAT_VEC2; m.size = m.alignment = 8; }
+	void fill( member &m, type<ivec2> ) { m.type = gl_type::INT_VEC2; m.size = m.alignment = 8; }
+	void fill( member &m, type<uvec2> ) { m.type = gl_type::UNSIGNED_INT_VEC2; m.size = m.alignment = 8; }
+	void fill( member &m, type<vec3> ) { m.type = gl_type::FLOAT_VEC3; m.size = 12; m.alignment = 16; }
+	void fill( member &m, type<ivec3> ) { m.type = gl_type::INT_VEC3; m.size = 12; m.alignment = 16; }
+	void fill( member &m, type<uvec3> ) { m.type = gl_type::UNSIGNED_INT_VEC3; m.size = 12; m.alignment = 16; }
+	void fill( member &m, type<vec4> ) { m.type = gl_type::FLOAT_VEC4; m.size = m.alignment = 16; }
+	void fill( member &m, type<ivec4> ) { m.type = gl_type::INT_VEC4; m.size = m.alignment = 16; }
+	void fill( member &m, type<uvec4> ) { m.type = gl_type::UNSIGNED_INT_VEC4; m.size = m.alignment = 16; }
+	void fill( member &m, type<mat4> ) { m.type = gl_type::FLOAT_MAT4; m.size = 64; m.alignment = 16; }
+
+	template <typename T, size_t N>
+	void fill( member &m, type<T[N]> ) { fill( m, type<T>() ); m.array_size = static_cast<unsigned>( N ); }
+
+	template <typename T1, typename T2, typename... Args>
+	void init( unsigned index, const char *memberName, T1 T2::*ptr, Args &&... args )
+	{
+		auto &m = members[index];
+		m.name = memberName;
+		m.offset = unsigned( size_t( &( ( ( T2 * )0 )->*ptr ) ) );
+		fill( m, type<T1>() );
+		size = sizeof( T2 );
+
+		if constexpr ( sizeof...( Args ) >= 2 )
+			init( index + 1, args... );
+	}
+
+	void validate();
+	static void register_layout( const block_layout *bl );
+};
+
 //---------------------------------------------------------------------------------------------------------------------
 class GL3D_API basic_object
 {
@@ -398,7 +579,7 @@ enum class shader_stage { vertex, geometry, fragment, compute, __count };
 GL3D_ENUM_PLUS( shader_stage )
 
 //---------------------------------------------------------------------------------------------------------------------
-class GL3D_API shader_code
+class GL3D_API shader_code : public std::enable_shared_from_this<shader_code>
 {
 public:
 	using ptr = std::shared_ptr<shader_code>;
@@ -406,23 +587,57 @@ public:
 	template <typename... Args>
 	static ptr create( Args &&... args ) { return std::make_shared<shader_code>( args... ); }
 
+	shader_code();
+	virtual ~shader_code();
+
 	const std::filesystem::path &path() const { return _path; }
 	const std::string &source() const { return _source; }
-	const std::string &unrolled_source() const { return _unrolledSource; }
 
 	const std::string &stage_source( shader_stage stage ) const { return _stageSources[+stage]; }
 
+	/// @brief All files included by the source, nested includes too
+	/// @note Index of file plus one is the source string number used by emitted `#line` directives
+	const detail::files_t &includes() const { return _includes; }
+
+	/// @brief Whether the code was loaded from given file or includes it
+	bool depends_on( const std::filesystem::path &path ) const;
+
+	/// @brief Reloads shader code depending on changed file and invalidates only programs built from it
+	/// @return Number of invalidated programs
+	static size_t file_changed( const std::filesystem::path &path );
+
 	bool source( std::string_view sourceCode, const std::filesystem::path &cwd = std::filesystem::path() );
 	bool load( std::istream &is, const std::filesystem::path &cwd = std::filesystem::path() );
 	bool load( const std::filesystem::path &path );
 
+	/// @brief Program variant compiled with given defines (e.g. "USE_FOG;NUM_LIGHTS=4"), compilation starts on first bind
+	/// @note Variants are cached by normalized defines, order of entries does not matter. Cache does not own them,
+	/// a variant is shared only as long as someone else holds it.
+	std::shared_ptr<shader> variant( std::string_view defines = std::string_view() );
+
+	/// @brief Forgets cached variants, programs still in use are not affected
+	void clear_variants();
+
 protected:
+	friend class shader;
+
 	std::filesystem::path _path;
+	std::filesystem::path _cwd;
 	std::string _source;
-	std::string _unrolledSource;
 	std::string _stageSources[+shader_stage::__count];
+	detail::files_t _includes;
+
+	std::mutex _variantsMutex;
+	std::unordered_map<std::string, std::weak_ptr<shader>> _variants; // Weak, shaders hold their code
+
+	// Separate from _variantsMutex, shaders register here while being created & destroyed by variant cache
+	std::mutex _programsMutex;
+	std::vector<shader *> _programs;
 };
 
+//---------------------------------------------------------------------------------------------------------------------
+enum class shader_status { not_compiled, compiling, ready, failed };
+
 //---------------------------------------------------------------------------------------------------------------------
 class GL3D_API shader : public detail::gl_object
 {
@@ -432,20 +647,147 @@ public:
 	template <typename... Args>
 	static ptr create( Args &&... args ) { return std::make_shared<shader>( args... ); }
 
-	shader( shader_code::ptr code, std::string_view defines = std::string_view() );
+	/// @param pulledLayout vertices of this layout are fetched from storage buffers instead of vertex arrays
+	shader( shader_code::ptr code, std::string_view defines = std::string_view(), const detail::layout *pulledLayout = nullptr );
 	virtual ~shader();
 
+	const shader_code::ptr &code() const { return _shaderCode; }
+
+	/// @brief Layout of vertices fetched by generated code, null when program uses vertex arrays
+	const detail::layout *pulled_layout() const { return _pulledLayout; }
+
+	/// @brief Normalized defines, entries sorted by name and separated by ';'
+	const std::string &defines() const { return _defines; }
+
 	void clear();
+
+	/// @brief Compiles and links the program, waits for the driver to finish
 	bool compile();
 
+	/// @brief Submits compilation and linking to the driver without waiting for the result
+	void compile_async();
+
+	/// @brief Polls status of compilation, does not block when KHR_parallel_shader_compile is supported
+	shader_status status();
+
+	/// @brief Marks program for recompilation on next bind and drops its cached binary
+	void invalidate();
+
+	/// @brief Program linked before invalidate(), bound instead of id() until the recompiled one is ready
+	unsigned previous_id() const { return _previousID; }
+
 protected:
+	uint64_t binary_key() const;
+	bool finish_compile();
+
+	shader_status _status = shader_status::not_compiled;
+	uint64_t _binaryKey = 0;
+	unsigned _previousID = 0;
+
 	shader_code::ptr _shaderCode;
 	std::string _defines;
+	const detail::layout *_pulledLayout = nullptr;
+	std::string _pullingSource;
 	unsigned _stageIDs[+shader_stage::__count] = { 0, 0, 0, 0 };
 };
 
+//---------------------------------------------------------------------------------------------------------------------
+struct GL3D_API shader_compiler
+{
+	/// @brief Number of driver threads compiling shaders in parallel (KHR_parallel_shader_compile)
+	static void max_threads( unsigned count );
+
+	/// @brief Submits all shaders for compilation up front, so they compile in parallel
+	static void submit( const detail::type_range<shader::ptr> &shaders );
+
+	/// @brief Number of submitted shaders still being compiled
+	static size_t pending();
+
+	/// @brief Program bound instead of shaders still being compiled, draws are skipped without it
+	static void placeholder( shader::ptr sh );
+	static shader::ptr placeholder();
+};
+
+//---------------------------------------------------------------------------------------------------------------------
+struct GL3D_API program_cache
+{
+	/// @brief Folder where linked program binaries are stored, empty path disables the cache
+	static void directory( const std::filesystem::path &path );
+	static std::filesystem::path directory();
+
+	/// @brief Creates program from cached binary, returns zero when binary is missing or rejected by the driver
+	static unsigned load( uint64_t key );
+
+	static void save( uint64_t key, unsigned programID );
+
+	static void remove( uint64_t key );
+
+	/// @brief Removes all cached binaries
+	static void clear();
+};
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+//---------------------------------------------------------------------------------------------------------------------
+struct GL3D_API sampler_state
+{
+	gl_enum wrap[3] = { gl_enum::REPEAT, gl_enum::REPEAT, gl_enum::REPEAT };
+	gl_enum filter[2] = { gl_enum::LINEAR_MIPMAP_LINEAR, gl_enum::LINEAR };
+	float max_anisotropy = 4.0f;
+	float min_lod = 0.0f;
+
+	size_t hash() const;
+
+	bool operator==( const sampler_state &rhs ) const
+	{
+		return
+		    wrap[0] == rhs.wrap[0] && wrap[1] == rhs.wrap[1] && wrap[2] == rhs.wrap[2] &&
+		    filter[0] == rhs.filter[0] && filter[1] == rhs.filter[1] &&
+		    max_anisotropy == rhs.max_anisotropy && min_lod == rhs.min_lod;
+	}
+
+	bool operator!=( const sampler_state &rhs ) const { return !( ( *this ) == rhs ); }
+
+	struct hasher { size_t operator()( const sampler_state &ss ) const { return ss.hash(); } };
+};
+
+namespace detail {
+
+class context;
+
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+class GL3D_API sampler : public detail::gl_object
+{
+public:
+	using ptr = std::shared_ptr<sampler>;
+
+	/// @brief Returns sampler object shared by everyone asking for the same state
+	static ptr get( const sampler_state &state );
+
+	sampler( const sampler_state &state );
+	virtual ~sampler();
+
+	const sampler_state &state() const { return _state; }
+
+	void synchronize();
+
+protected:
+	friend struct texture_residency;
+	friend class detail::context;
+
+	/// @brief Deletes shared samplers nobody but the cache references anymore, a context has to be current
+	static void release_unused();
+
+	/// @brief Drops all shared samplers when the last context goes away, GL objects are deleted only when it is current
+	static void release_cache( bool current );
+
+	sampler_state _state;
+	std::mutex _mutex; // Render threads of several windows may synchronize the same sampler
+};
+
+//---------------------------------------------------------------------------------------------------------------------
 class GL3D_API texture : public detail::gl_object
 {
 public:
@@ -458,6 +800,10 @@ public:
 	static ptr checkerboard();
 	static ptr debug_grid();
 
+	/// @brief Loads KTX2 or DDS texture through vfs::map, mip levels are uploaded straight from the mapping
+	/// @note Smallest mip levels are uploaded first, finer levels stream in over the following frames
+	static ptr load( const std::filesystem::path &path );
+
 	texture( gl_enum type, gl_internal_format format, const uvec3 &dimensions, bool hasMips = false );
 
 	texture( gl_internal_format format, const uvec2 &dimensions, bool hasMips = false )
@@ -513,6 +859,11 @@ public:
 		return maximum( 1, _dimensions.z >> mipLevel );
 	}
 
+	unsigned mip_levels() const { return _mipLevels; }
+
+	/// @brief Whether some mip levels of loaded texture are still waiting to be uploaded
+	bool streaming() const { return _streamedLevel > 0; }
+
 	unsigned array_size() const
 	{
 		if ( _type == gl_enum::TEXTURE_2D_ARRAY )
@@ -525,28 +876,49 @@ public:
 
 	float aspect_ratio() const { return static_cast<float>( _dimensions.x ) / _dimensions.y; }
 
+	/// @brief Estimated size of texture storage in video memory (all layers and mip levels)
+	size_t memory_size() const;
+
+	/// @brief Whether bindless handles are currently resident in at least one context
+	bool resident() const { return _resident; }
+
 	void wrap( gl_enum u, gl_enum v, gl_enum w );
 	void filter( gl_enum minFilter, gl_enum magFilter );
 
-	void wrap_u( gl_enum value ) { wrap( value, _wrap[1], _wrap[2] ); }
-	gl_enum wrap_u() const { return _wrap[0]; }
+	void wrap_u( gl_enum value ) { wrap( value, _samplerState.wrap[1], _samplerState.wrap[2] ); }
+	gl_enum wrap_u() const { return _samplerState.wrap[0]; }
 
-	void wrap_v( gl_enum value ) { wrap( _wrap[0], value, _wrap[2] ); }
-	gl_enum wrap_v() const { return _wrap[1]; }
+	void wrap_v( gl_enum value ) { wrap( _samplerState.wrap[0], value, _samplerState.wrap[2] ); }
+	gl_enum wrap_v() const { return _samplerState.wrap[1]; }
 
-	void wrap_w( gl_enum value ) { wrap( _wrap[0], _wrap[1], value ); }
-	gl_enum wrap_w() const { return _wrap[2]; }
+	void wrap_w( gl_enum value ) { wrap( _samplerState.wrap[0], _samplerState.wrap[1], value ); }
+	gl_enum wrap_w() const { return _samplerState.wrap[2]; }
 
-	void filter_min( gl_enum value ) { filter( value, _filter[1] ); }
-	gl_enum filter_min() const { return _filter[0]; }
+	void filter_min( gl_enum value ) { filter( value, _samplerState.filter[1] ); }
+	gl_enum filter_min() const { return _samplerState.filter[0]; }
 
-	void filter_mag( gl_enum value ) { filter( _filter[0], value ); }
-	gl_enum filter_mag() const { return _filter[1]; }
+	void filter_mag( gl_enum value ) { filter( _samplerState.filter[0], value ); }
+	gl_enum filter_mag() const { return _samplerState.filter[1]; }
 
-	uint64_t synchronize();
+	/// @brief Shared sampler object matching wrap & filter settings of this texture
+	sampler::ptr default_sampler();
+
+	/// @brief Sampler really used for sampling, LOD is clamped to mip levels already uploaded
+	sampler::ptr effective_sampler( const sampler::ptr &smp = nullptr );
+
+	/// @brief Creates GL texture if needed and returns bindless handle for texture + sampler pair
+	/// @param smp sampler used for sampling, `nullptr` means default sampler of this texture
+	/// @note Handle is made resident in the current context, the texture may be used by several render threads
+	uint64_t synchronize( const sampler::ptr &smp = nullptr );
 
 protected:
+	friend struct texture_residency;
+
 	void clear();
+	void upload_level( unsigned mipLevel );
+	void make_resident( unsigned slot );
+	/// @brief Forgets residency of all handles, called before the texture and its handles are deleted
+	void make_non_resident();
 
 	gl_enum _type = gl_enum::NONE;
 	gl_internal_format _format = gl_internal_format::NONE;
@@ -556,12 +928,97 @@ protected:
 	unsigned _numParts = 0;
 	bool _owner = false;
 	bool _buildMips = false;
+	unsigned _mipLevels = 1;
 
-	gl_enum _wrap[3] = { gl_enum::REPEAT, gl_enum::REPEAT, gl_enum::REPEAT };
-	gl_enum _filter[2] = { gl_enum::LINEAR_MIPMAP_LINEAR, gl_enum::LINEAR };
-	bool _dirtySampler = true;
+	detail::mapped_file::ptr _source;
+	unsigned _streamedLevel = 0;
+	unsigned _lastStreamFrame = 0;
 
-	uint64_t _bindlessHandle = 0;
+	sampler_state _samplerState;
+	sampler::ptr _defaultSampler;
+
+	struct sampler_handle
+	{
+		sampler::ptr smp;
+		uint64_t handle = 0;
+		uint64_t resident_mask = 0; // Bit per context residency slot
+		unsigned last_used_frame = 0;
+		bool lod_clamp = false; // Sampler of a streamed texture, see effective_sampler()
+	};
+
+	/// @brief Queues handle to be made non-resident in every context it is resident in, residency mutex has to be locked
+	void retire( sampler_handle &sh );
+
+	std::mutex _mutex; // Guards creation & uploads, render threads of several windows may synchronize the texture
+
+	std::vector<sampler_handle> _handles; // Changed with both _mutex & residency mutex locked
+	unsigned _lastUsedFrame = 0;
+	bool _resident = false; // Resident in at least one context
+};
+
+//---------------------------------------------------------------------------------------------------------------------
+struct GL3D_API texture_residency
+{
+	/// @brief Maximum number of bytes kept resident by bindless textures, zero means unlimited
+	static void budget( size_t bytes );
+	static size_t budget();
+
+	/// @brief Number of bytes currently occupied by resident textures
+	static size_t resident_size();
+
+	/// @brief Advances frame counter, evicts least recently used textures exceeding the budget and deletes shared
+	/// samplers no longer referenced
+	/// @note Handles are resident per context, each context makes evicted handles non-resident in its own
+	/// detail::context::next_frame() once the GPU cannot read them anymore
+	static void next_frame();
+
+protected:
+	friend class texture;
+	friend class detail::context;
+
+	/// @brief Returns free context slot, residency of a handle is tracked by one bit per slot
+	static unsigned acquire_slot();
+
+	/// @brief Forgets residency in the context of the slot and frees it, returns whether it was the last slot in use
+	static bool release_slot( unsigned slot );
+
+	/// @brief Makes handles retired at least k_residencyLatency frames ago non-resident, context of the slot
+	/// has to be current
+	static void flush_retired( unsigned slot );
+};
+
+//---------------------------------------------------------------------------------------------------------------------
+struct GL3D_API render_target_pool
+{
+	struct desc
+	{
+		gl_internal_format format = gl_internal_format::RGBA8;
+		uvec2 size;
+		unsigned samples = 1;
+
+		bool operator==( const desc &rhs ) const { return format == rhs.format && size == rhs.size && samples == rhs.samples; }
+		bool operator!=( const desc &rhs ) const { return !( ( *this ) == rhs ); }
+	};
+
+	/// @brief Returns render target texture matching the descriptor, valid until the end of current frame
+	static texture::ptr acquire( const desc &d );
+
+	static texture::ptr acquire( gl_internal_format format, const uvec2 &size, unsigned samples = 1 )
+	{
+		return acquire( desc{ format, size, samples } );
+	}
+
+	/// @brief Returns texture to the pool before the end of frame, so later passes can alias its memory
+	/// @note Commands using the texture have to be executed before commands of passes acquiring it next
+	static void release( const texture::ptr &tex );
+
+	/// @brief Recycles all acquired textures and destroys those unused for several frames
+	static void next_frame();
+
+	/// @brief Total number of textures owned by the pool, including ones acquired this frame
+	static size_t size();
+
+	static void clear();
 };
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -617,6 +1074,52 @@ struct GL3D_API rasterizer_state
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+//---------------------------------------------------------------------------------------------------------------------
+struct GL3D_API gpu_zone
+{
+	std::string name;
+	unsigned depth = 0;       // Nesting level, zero for top level zones
+	double start_ms = 0.0;    // Relative to start of the first zone in frame
+	double duration_ms = 0.0;
+};
+
+//---------------------------------------------------------------------------------------------------------------------
+/// @brief Pixels delivered by cmd_queue::read_pixels_async, data is valid only during the callback
+struct GL3D_API readback
+{
+	uvec4 rect;                    // x, y, width, height
+	gl_format format = gl_format::NONE;
+	gl_type type = gl_type::NONE;
+	const uint8_t *data = nullptr; // Tightly packed rows, bottom row first
+	size_t size = 0;
+};
+
+//---------------------------------------------------------------------------------------------------------------------
+/// @brief GPU fence, signaled once all commands issued before cmd_queue::insert_fence are finished
+class GL3D_API fence : public detail::basic_object
+{
+public:
+	using ptr = std::shared_ptr<fence>;
+
+	template <typename... Args>
+	static ptr create() { return std::make_shared<fence>(); }
+
+	virtual ~fence();
+
+	/// @brief Polls the fence without blocking, fence which was never inserted is signaled
+	bool signaled();
+
+	/// @brief Blocks until the GPU passes the fence, flushes commands of the current context
+	void wait();
+
+protected:
+	friend class cmd_queue;
+
+	void *_sync = nullptr;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
 class GL3D_API cmd_queue : public detail::basic_object
 {
 public:
@@ -635,7 +1138,15 @@ public:
 	void clear_color( const vec4 &color );
 	void clear_depth( float depth );
 
+	/// @brief Replaces content of the whole layer & mip level
 	void update_texture( texture::ptr tex, const void *data, unsigned layer = 0, unsigned mipLevel = 0, size_t rowStride = 0 );
+
+	/// @brief Replaces content of rectangle within the layer & mip level, mip chain is not regenerated
+	/// @param rowStride distance between rows of source data in bytes, zero means tightly packed rows
+	/// @note Compressed formats are updated in whole 4x4 blocks, rows are then rows of blocks
+	void update_texture( texture::ptr tex, const void *data, const uvec2 &offset, const uvec2 &size,
+	                     unsigned layer = 0, unsigned mipLevel = 0, size_t rowStride = 0 );
+
 	void update_buffer( buffer::ptr buff, const void *data, size_t size, size_t offset = 0, bool preserveContent = false );
 	void resize_buffer( buffer::ptr buff, const void *data, size_t size );
 	void resize_buffer( buffer::ptr buff, size_t size ) { resize_buffer( buff, nullptr, size ); }
@@ -645,9 +1156,16 @@ public:
 	void bind_vertex_attribute( buffer::ptr attribs, unsigned slot, gl_enum glType, bool perInstance = false, size_t offset = 0, size_t stride = 0 );
 	void bind_index_buffer( buffer::ptr indices, bool use16bits = false, size_t offset = 0 );
 
-	void bind_texture( texture::ptr tex, unsigned slot );
+	void bind_texture( texture::ptr tex, unsigned slot, sampler::ptr smp = nullptr );
 	void bind_storage_buffer( buffer::ptr buff, unsigned slot, size_t offset = 0, size_t length = size_t( -1 ) );
 
+	/// @brief Binds mip level of texture to image unit for load/store access
+	/// @param layer single layer to bind, -1 binds all layers of array, cube & 3D textures
+	/// @param format format of image unit, NONE uses texture format. sRGB textures need an explicit format of the same
+	///        pixel size, e.g. RGBA8 for SRGB8_ALPHA8, RGB, depth & compressed textures can't be bound as images
+	void bind_image( texture::ptr tex, unsigned slot, gl_enum access = gl_enum::READ_WRITE, unsigned mipLevel = 0, int layer = -1,
+		gl_internal_format format = gl_internal_format::NONE );
+
 	struct GL3D_API render_target
 	{
 		texture::ptr target;
@@ -681,6 +1199,20 @@ public:
 
 	void unbind_render_targets( bool adjustViewport = true ) { bind_render_targets( {}, nullptr, adjustViewport ); }
 
+	using readback_callback = std::function<void( const readback & )>;
+
+	/// @brief Copies rectangle (x, y, width, height) of render target into pixel pack buffer guarded by a fence,
+	/// callback runs from detail::context::next_frame() of the executing context once the GPU finished the copy
+	/// @param source texture layer & mip level to read, nullptr reads default framebuffer of the executing context
+	/// @param format & type of returned pixels, NONE format uses native format of the texture (RGBA8 for default
+	/// framebuffer), NONE type with explicit format means UNSIGNED_BYTE
+	void read_pixels_async( const render_target &source, const uvec4 &rect, readback_callback callback,
+	                        gl_format format = gl_format::NONE, gl_type type = gl_type::NONE );
+
+	/// @brief Future becomes ready in next_frame() a few frames later, never wait for it on the context thread
+	std::future<std::vector<uint8_t>> read_pixels_async( const render_target &source, const uvec4 &rect,
+	                                                     gl_format format = gl_format::NONE, gl_type type = gl_type::NONE );
+
 	void set_uniform_block( const detail::location_variant &location, const void *data, size_t size );
 
 	template <typename T>
@@ -689,6 +1221,14 @@ public:
 		set_uniform_block( location, &block, sizeof( T ) );
 	}
 
+	/// @brief Uploads struct described by GL3D_BLOCK_LAYOUT to the uniform block of the same name
+	/// @note Uniform blocks are std140, std430 layouts describe shader storage blocks
+	template <typename T>
+	void set_uniform_block( const T &block )
+	{
+		set_uniform_block( detail::location_variant( T::block_layout().name ), &block, sizeof( T ) );
+	}
+
 	void set_uniform( const detail::location_variant &location, bool value );
 	void set_uniform( const detail::location_variant &location, int value );
 	void set_uniform( const detail::location_variant &location, float value );
@@ -697,7 +1237,7 @@ public:
 	void set_uniform( const detail::location_variant &location, const vec4 &value );
 	void set_uniform( const detail::location_variant &location, const mat3 &value, bool transpose = false );
 	void set_uniform( const detail::location_variant &location, const mat4 &value, bool transpose = false );
-	void set_uniform( const detail::location_variant &location, texture::ptr tex );
+	void set_uniform( const detail::location_variant &location, texture::ptr tex, sampler::ptr smp = nullptr );
 
 	void set_uniform( const detail::location_variant &location, const uint64_t *values, size_t count );
 	void set_uniform( const detail::location_variant &location, const uvec3 *values, size_t count );
@@ -731,9 +1271,31 @@ public:
 	void draw( gl_enum primitive, size_t first, size_t count, size_t instanceCount = 1, size_t instanceBase = 0 );
 	void draw_indexed( gl_enum primitive, size_t first, size_t count, size_t instanceCount = 1, size_t instanceBase = 0 );
 
+	void dispatch( unsigned groupsX, unsigned groupsY = 1, unsigned groupsZ = 1 );
+
+	/// @brief Reads work group counts (3x uint) from the buffer at given offset
+	void dispatch_indirect( buffer::ptr args, size_t offset = 0 );
+
+	/// @brief Makes writes done by shaders visible to later commands
+	/// @param barriers combination of gl_enum::*_BARRIER_BIT flags
+	void memory_barrier( unsigned barriers = +gl_enum::ALL_BARRIER_BITS );
+
+	/// @brief Starts nested GPU timer zone, also pushes KHR_debug group for external tools
+	void begin_zone( const char *name );
+	void end_zone();
+
+	/// @brief (Re)arms fence to signal once all previously executed commands finish
+	void insert_fence( fence::ptr f );
+
 	void execute( ptr cmdQueue );
 
 protected:
+	// Frames between recording timer queries and reading their results
+	static constexpr unsigned gpu_zone_latency = 3;
+
+	// Frames a free readback PBO can stay unused before it gets deleted
+	static constexpr unsigned readback_max_unused_frames = 60;
+
 	struct gl_state
 	{
 		buffer::ptr temp_buffer;
@@ -750,6 +1312,51 @@ protected:
 		size_t current_ib_offset = 0;
 
 		bool dirty_input_assembly = true;
+		bool skip_draws = false;
+
+		const detail::layout *pulled_layout = nullptr;
+		unsigned pulling_params[4] = { 0, 0, 0, 0 };
+		bool dirty_pulling_params = true;
+
+		struct zone_queries
+		{
+			std::string name;
+			unsigned depth = 0;
+			unsigned start_query = 0;
+			unsigned end_query = 0;
+		};
+
+		std::vector<zone_queries> zone_frames[gpu_zone_latency];
+		std::vector<size_t> open_zones;
+		std::vector<unsigned> free_queries;
+		std::vector<gpu_zone> resolved_zones;
+		unsigned zone_frame = 0;
+
+		unsigned acquire_query();
+		void resolve_zones();
+		void release_queries();
+
+		struct pixel_buffer
+		{
+			unsigned id = 0;
+			size_t capacity = 0;
+			unsigned unused_frames = 0;
+		};
+
+		struct pending_readback
+		{
+			pixel_buffer pbo;
+			void *fence = nullptr;
+			readback result;
+			readback_callback callback;
+		};
+
+		std::vector<pending_readback> pending_readbacks; // In order of fences
+		std::vector<pixel_buffer> free_pbos;
+
+		pixel_buffer acquire_pbo( size_t size );
+		void resolve_readbacks();
+		void release_readbacks();
 
 		void reset();
 		size_t write_temp_data( const void *data, size_t size );
@@ -781,6 +1388,21 @@ protected:
 		_position += len;
 	}
 
+	void write_data( const void *data, size_t rowSize, size_t numRows, size_t rowStride )
+	{
+		auto size = rowSize * numRows;
+		auto len = sizeof( unsigned ) + size;
+		if ( _position + len > _recordedData.size() )
+			_recordedData.resize( _position + len );
+
+		memcpy( _recordedData.data() + _position, &size, sizeof( unsigned ) );
+		_position += sizeof( unsigned );
+
+		// Rows are stored tightly packed
+		for ( size_t i = 0; i < numRows; ++i, _position += rowSize )
+			memcpy( _recordedData.data() + _position, static_cast<const uint8_t *>( data ) + i * rowStride, rowSize );
+	}
+
 	template <typename H, typename... T>
 	void write_value( uint8_t *cursor, H &&head, T &&... tail )
 	{
@@ -840,6 +1462,7 @@ protected:
 	}
 
 	bool synchronize_input_assembly();
+	void synchronize_pulling_params( bool indexed );
 	void execute( gl_state *state );
 
 	bool _deferred = true;
@@ -854,9 +1477,12 @@ protected:
 		update_texture, update_buffer, resize_buffer,
 		bind_blend_state, bind_depth_stencil_state, bind_rasterizer_state,
 		bind_shader, bind_vertex_buffer, bind_vertex_attribute, bind_index_buffer,
-		bind_texture, bind_storage_buffer, bind_render_targets,
+		bind_texture, bind_storage_buffer, bind_image, bind_render_targets,
 		set_uniform_block, set_uniform, set_uniform_array,
 		draw, draw_indexed,
+		dispatch, dispatch_indirect, memory_barrier,
+		begin_zone, end_zone,
+		read_pixels_async, insert_fence,
 		execute,
 	};
 };
@@ -878,6 +1504,11 @@ public:
 	void *window_native_handle() const { return _window_native_handle; }
 	void *native_handle() const { return _native_handle; }
 
+#if defined(__linux__)
+	/// @brief Replaces pbuffer surface used as default framebuffer, e.g. after resize of headless window
+	void window_native_handle( void *surface );
+#endif
+
 	void make_current( const uvec2 &defaultFBSize = { 0, 0 } );
 
 	unsigned get_or_create_layout_vao( const detail::layout *layout );
@@ -885,6 +1516,42 @@ public:
 
 	uvec2 default_framebuffer_size() const { return _defaultFramebufferSize; }
 
+	/// @brief Whether the driver exposes extension (e.g. "GL_KHR_parallel_shader_compile") to this context
+	/// @note Extensions are queried when the context is made current for the first time
+	bool has_extension( std::string_view name ) const;
+
+	/// @brief KHR_parallel_shader_compile is supported, programs can be polled for completion
+	bool parallel_shader_compile() const { return _parallelShaderCompile; }
+
+	/// @brief Slot tracking residency of bindless handles in this context, see texture_residency
+	unsigned residency_slot() const { return _residencySlot; }
+
+	/// @brief VAO without any attributes, bound for all draws using vertex pulling
+	unsigned empty_vao();
+
+	/// @brief GPU zones of the frame recorded gpu_zone_latency frames ago, in order of begin_zone calls
+	/// @note Empty when results of that frame were not available in time and the frame was dropped
+	const std::vector<gpu_zone> &gpu_zones() const { return _glState.resolved_zones; }
+
+	/// @brief Ages cached VAOs & FBOs and deletes those unused for more than max_unused_frames(), resolves GPU zones,
+	/// invokes callbacks of finished read_pixels_async requests and makes retired bindless handles non-resident
+	/// @note Context has to be current
+	void next_frame();
+
+	/// @brief Number of frames after which unused VAOs & FBOs are deleted
+	void max_unused_frames( unsigned frames ) { _maxUnusedFrames = frames; }
+	unsigned max_unused_frames() const { return _maxUnusedFrames; }
+
+	struct cache_stats
+	{
+		size_t vaos = 0;
+		size_t fbos = 0;
+		size_t evicted_vaos = 0; // Total since context creation
+		size_t evicted_fbos = 0;
+	};
+
+	cache_stats stats() const;
+
 protected:
 	void *_window_native_handle = nullptr;
 	void *_native_handle = nullptr;
@@ -897,9 +1564,26 @@ protected:
 	};
 
 	std::unordered_map<std::uintptr_t, vao_desc> _layoutVAOs;
+	unsigned _emptyVAO = 0;
+
+	/// @brief Attachment set without reference counting, color targets are followed by depth stencil target
+	struct fbo_signature
+	{
+		const texture *targets[max_render_targets + 1] = { };
+		unsigned layers[max_render_targets + 1] = { };
+		unsigned mip_levels[max_render_targets + 1] = { };
+		unsigned num_color_targets = 0;
+		size_t hash = 0;
+
+		fbo_signature() = default;
+		fbo_signature( const render_target *colorTargets, size_t count, const render_target &depthStencilTarget );
+
+		bool operator==( const fbo_signature &rhs ) const;
+	};
 
 	struct fbo_desc
 	{
+		fbo_signature signature;
 		render_target color_targets[max_render_targets];
 		render_target depth_stencil_target;
 		unsigned num_color_targets = 0;
@@ -907,7 +1591,29 @@ protected:
 		unsigned unused_frames = 0;
 	};
 
+	unsigned find_fbo( const fbo_signature &signature ) const;
+	void insert_fbo( unsigned index );
+	void rebuild_fbo_table( size_t capacity );
+
+	// Function pointers cannot tell, EGL returns non-null pointers even for names the driver does not know
+	void query_extensions();
+
+	/// @brief Deletes objects which belong to this context only, called by destructor with the context current
+	/// @param lastContext shared samplers are deleted as well, nobody could delete them later
+	void release( bool lastContext );
+
+	unsigned _residencySlot = texture_residency::acquire_slot();
+
+	std::vector<std::string> _extensions; // Sorted
+	bool _extensionsQueried = false;
+	bool _parallelShaderCompile = false;
+
 	std::vector<fbo_desc> _fboDescs;
+	std::vector<unsigned> _fboTable; // Open addressing with linear probing, indices into _fboDescs
+
+	unsigned _maxUnusedFrames = 300;
+	size_t _evictedVAOs = 0;
+	size_t _evictedFBOs = 0;
 
 	gl_state _glState;
 	uvec2 _defaultFramebufferSize;
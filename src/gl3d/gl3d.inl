@@ -18,12 +18,15 @@
 		#define WIN32_LEAN_AND_MEAN
 	#endif
 	#include <windows.h>
+	#include <gl/GL.h>
+#elif defined(__linux__)
+	#include <EGL/egl.h>
+	#include <EGL/eglext.h>
+	#include <GL/gl.h>
 #else
 	#error Not implemented!
 #endif
 
-#include <gl/GL.h>
-
 #include <cassert>
 
 namespace gl3d {
@@ -45,22 +48,57 @@ int find_uniform_id( const detail::location_variant &location )
 	return gl.GetUniformLocation( programID, location.data );
 }
 
+//---------------------------------------------------------------------------------------------------------------------
+int find_uniform_block_binding( const detail::location_variant &location )
+{
+	if ( !location.holds_name() )
+		return location.id();
+
+	int programID;
+	glGetIntegerv( +gl_enum::CURRENT_PROGRAM, &programID );
+
+	auto index = gl.GetProgramResourceIndex( programID, gl_enum::UNIFORM_BLOCK, location.data );
+	if ( index == UINT_MAX )
+		return -1;
+
+	const gl_enum prop = gl_enum::BUFFER_BINDING;
+	int binding = -1;
+	gl.GetProgramResourceiv( programID, gl_enum::UNIFORM_BLOCK, index, 1, &prop, 1, nullptr, &binding );
+	return binding;
+}
+
 //---------------------------------------------------------------------------------------------------------------------
 struct internal_format
 {
 	gl_format components = gl_format::NONE;
 	gl_type type = gl_type::NONE;
 	unsigned pixel_size = 0;
+	unsigned block_size = 0; // Size of 4x4 block in bytes for compressed formats
 };
 
 //---------------------------------------------------------------------------------------------------------------------
 internal_format get_internal_format( gl_internal_format format )
 {
-	static std::unordered_map<gl_internal_format, internal_format> s_internalFormatMap =
+	// Never destroyed, textures held by globals query their format during static destruction
+	static const auto &s_internalFormatMap = *new std::unordered_map<gl_internal_format, internal_format>
 	{
 		{ gl_internal_format::R8, { gl_format::RED, gl_type::UNSIGNED_BYTE, 1 } },
 		{ gl_internal_format::RGB8, { gl_format::RGB, gl_type::UNSIGNED_BYTE, 3 } },
 		{ gl_internal_format::RGBA8, { gl_format::RGBA, gl_type::UNSIGNED_BYTE, 4 } },
+		{ gl_internal_format::SRGB8_ALPHA8, { gl_format::RGBA, gl_type::UNSIGNED_BYTE, 4 } },
+		{ gl_internal_format::RG8, { gl_format::RG, gl_type::UNSIGNED_BYTE, 2 } },
+		{ gl_internal_format::RGBA16F, { gl_format::RGBA, gl_type::HALF_FLOAT, 8 } },
+		{ gl_internal_format::RGBA32F, { gl_format::RGBA, gl_type::FLOAT, 16 } },
+		{ gl_internal_format::COMPRESSED_RGB_S3TC_DXT1, { gl_format::RGB, gl_type::NONE, 0, 8 } },
+		{ gl_internal_format::COMPRESSED_RGBA_S3TC_DXT1, { gl_format::RGBA, gl_type::NONE, 0, 8 } },
+		{ gl_internal_format::COMPRESSED_RGBA_S3TC_DXT3, { gl_format::RGBA, gl_type::NONE, 0, 16 } },
+		{ gl_internal_format::COMPRESSED_RGBA_S3TC_DXT5, { gl_format::RGBA, gl_type::NONE, 0, 16 } },
+		{ gl_internal_format::COMPRESSED_RED_RGTC1, { gl_format::RED, gl_type::NONE, 0, 8 } },
+		{ gl_internal_format::COMPRESSED_RG_RGTC2, { gl_format::RG, gl_type::NONE, 0, 16 } },
+		{ gl_internal_format::COMPRESSED_RGBA_BPTC_UNORM, { gl_format::RGBA, gl_type::NONE, 0, 16 } },
+		{ gl_internal_format::COMPRESSED_SRGB_ALPHA_BPTC_UNORM, { gl_format::RGBA, gl_type::NONE, 0, 16 } },
+		{ gl_internal_format::COMPRESSED_RGB_BPTC_SIGNED_FLOAT, { gl_format::RGB, gl_type::NONE, 0, 16 } },
+		{ gl_internal_format::COMPRESSED_RGB_BPTC_UNSIGNED_FLOAT, { gl_format::RGB, gl_type::NONE, 0, 16 } },
 		{ gl_internal_format::DEPTH_COMPONENT32F, { gl_format::DEPTH_COMPONENT, gl_type::FLOAT, 4 } },
 		{ gl_internal_format::DEPTH24_STENCIL8, { gl_format::DEPTH_STENCIL, gl_type::UNSIGNED_INT_24_8, 4 } },
 		{ gl_internal_format::DEPTH32F_STENCIL8, { gl_format::DEPTH_STENCIL, gl_type::FLOAT_32_UNSIGNED_INT_24_8_REV, 8 } },
@@ -73,10 +111,98 @@ internal_format get_internal_format( gl_internal_format format )
 	return internal_format();
 }
 
+//---------------------------------------------------------------------------------------------------------------------
+bool is_image_format( gl_internal_format format )
+{
+	// Formats accepted by BindImageTexture, sRGB, RGB, depth & compressed ones are not
+	switch ( format )
+	{
+		case gl_internal_format::RGBA8: case gl_internal_format::RGBA16F: case gl_internal_format::RGBA32F:
+		case gl_internal_format::R8: case gl_internal_format::R16: case gl_internal_format::RG8: case gl_internal_format::RG16:
+		case gl_internal_format::R16F: case gl_internal_format::R32F: case gl_internal_format::RG16F: case gl_internal_format::RG32F:
+		case gl_internal_format::R8I: case gl_internal_format::R8UI: case gl_internal_format::R16I: case gl_internal_format::R16UI:
+		case gl_internal_format::R32I: case gl_internal_format::R32UI: case gl_internal_format::RG8I: case gl_internal_format::RG8UI:
+		case gl_internal_format::RG16I: case gl_internal_format::RG16UI: case gl_internal_format::RG32I: case gl_internal_format::RG32UI:
+			return true;
+
+		default:
+			return false;
+	}
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+size_t image_size( const internal_format &format, unsigned width, unsigned height )
+{
+	if ( format.block_size )
+		return static_cast<size_t>( ( width + 3 ) / 4 ) * ( ( height + 3 ) / 4 ) * format.block_size;
+
+	return static_cast<size_t>( width ) * height * format.pixel_size;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+unsigned pixel_size( gl_format format, gl_type type )
+{
+	// Packed types cover all components
+	if ( type == gl_type::UNSIGNED_INT_24_8 )
+		return 4;
+	else if ( type == gl_type::FLOAT_32_UNSIGNED_INT_24_8_REV )
+		return 8;
+
+	unsigned components = 0;
+	switch ( format )
+	{
+		case gl_format::RED:
+		case gl_format::STENCIL_INDEX:
+		case gl_format::DEPTH_COMPONENT: components = 1; break;
+		case gl_format::RG:
+		case gl_format::DEPTH_STENCIL: components = 2; break;
+		case gl_format::RGB:
+		case gl_format::BGR: components = 3; break;
+		case gl_format::RGBA:
+		case gl_format::BGRA: components = 4; break;
+		default: assert( 0 ); break;
+	}
+
+	switch ( type )
+	{
+		case gl_type::BYTE:
+		case gl_type::UNSIGNED_BYTE: return components;
+		case gl_type::SHORT:
+		case gl_type::UNSIGNED_SHORT:
+		case gl_type::HALF_FLOAT: return components * 2;
+		case gl_type::INT:
+		case gl_type::UNSIGNED_INT:
+		case gl_type::FLOAT: return components * 4;
+		default: assert( 0 ); break;
+	}
+
+	return 0;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+/// @brief Keeps callback of deferred read_pixels_async alive among other resources of the queue
+struct readback_request : basic_object
+{
+	cmd_queue::readback_callback callback;
+
+	readback_request( cmd_queue::readback_callback &&cb ): callback( std::move( cb ) ) { }
+};
+
 //---------------------------------------------------------------------------------------------------------------------
 unsigned mip_level_count( const uvec3 &size )
 {
-	return 1 + static_cast<unsigned>( floor( log2( static_cast<float>( maximum( size.x, size.y, size.z ) ) ) ) );
+	// Integer version, float log2 rounds sizes close to 2^32 up to 33 levels
+	unsigned result = 1;
+	for ( auto s = maximum( size.x, size.y, size.z ); s > 1; s >>= 1 )
+		++result;
+
+	return result;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+constexpr uint32_t make_four_cc( char a, char b, char c, char d )
+{
+	return uint32_t( a ) | ( uint32_t( b ) << 8 ) | ( uint32_t( c ) << 16 ) | ( uint32_t( d ) << 24 );
 }
 
 } // namespace gl3d::detail
@@ -109,6 +235,256 @@ void check_gl_error()
 #endif
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace detail {
+
+//---------------------------------------------------------------------------------------------------------------------
+std::string vertex_pulling_source( const layout &l )
+{
+	assert( ( l.stride & 3 ) == 0 );
+
+	char text[256];
+	std::string result;
+
+	// Header is longer than the formatting buffer, only short per-attribute lines go through snprintf
+	result += "#define GL3D_VERTEX_PULLING 1\n";
+	result += "layout(std430, binding = " + std::to_string( vertex_pulling_vb_binding ) + ") readonly buffer gl3d_VertexBuffer { uint gl3d_vertexWords[]; };\n";
+	result += "layout(std430, binding = " + std::to_string( vertex_pulling_ib_binding ) + ") readonly buffer gl3d_IndexBuffer { uint gl3d_indexWords[]; };\n";
+
+	// Byte offsets of VB & IB, indexed draw, 16bit indices
+	result += "layout(location = " + std::to_string( vertex_pulling_params_location ) + ") uniform uvec4 gl3d_pulling;\n";
+
+	result +=
+	    "uint gl3d_vertex_index()\n"
+	    "{\n"
+	    "\tif (gl3d_pulling.z == 0u) return uint(gl_VertexID);\n"
+	    "\tuint pos = gl3d_pulling.y + uint(gl_VertexID) * (gl3d_pulling.w != 0u ? 2u : 4u);\n"
+	    "\tuint word = gl3d_indexWords[pos >> 2];\n"
+	    "\treturn gl3d_pulling.w != 0u ? ((pos & 2u) != 0u ? (word >> 16) : (word & 0xFFFFu)) : word;\n"
+	    "}\n";
+
+	auto typeName = []( const layout::attr &a )
+	{
+		static const char *s_floatTypes[] = { "float", "vec2", "vec3", "vec4" };
+		static const char *s_intTypes[] = { "int", "ivec2", "ivec3", "ivec4" };
+		static const char *s_uintTypes[] = { "uint", "uvec2", "uvec3", "uvec4" };
+
+		if ( !a.is_integer )
+			return s_floatTypes[a.element_count - 1];
+
+		return ( a.element_type == gl_type::INT ) ? s_intTypes[a.element_count - 1] : s_uintTypes[a.element_count - 1];
+	};
+
+	for ( auto &a : l.attribs )
+	{
+		snprintf( text, sizeof( text ), "%s gl3d_attrib%u;\n", typeName( a ), a.location );
+		result += text;
+	}
+
+	result +=
+	    "void gl3d_fetch_vertex()\n"
+	    "{\n";
+
+	snprintf( text, sizeof( text ), "\tuint base = (gl3d_pulling.x + gl3d_vertex_index() * %uu) >> 2;\n", l.stride );
+	result += text;
+
+	for ( auto &a : l.attribs )
+	{
+		assert( ( a.offset & 3 ) == 0 );
+		auto word = a.offset / 4;
+
+		snprintf( text, sizeof( text ), "\tgl3d_attrib%u = %s(", a.location, typeName( a ) );
+		result += text;
+
+		// Same conversions as vertex arrays do, bytes are not normalized
+		if ( a.element_type == gl_type::UNSIGNED_BYTE )
+		{
+			assert( a.element_count == 4 );
+			snprintf( text, sizeof( text ), "unpackUnorm4x8(gl3d_vertexWords[base + %uu]) * 255.0", word );
+			result += text;
+		}
+		else
+		{
+			const char *conversion = ( a.element_type == gl_type::FLOAT ) ? "uintBitsToFloat" : ( a.element_type == gl_type::INT ) ? "int" : "";
+
+			for ( unsigned i = 0; i < a.element_count; ++i )
+			{
+				snprintf( text, sizeof( text ), "%s%s(gl3d_vertexWords[base + %uu])", i ? ", " : "", conversion, word + i );
+				result += text;
+			}
+		}
+
+		result += ");\n";
+	}
+
+	result += "}\n";
+	return result;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+std::mutex &block_layouts_mutex()
+{
+	static std::mutex s_mutex;
+	return s_mutex;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+std::unordered_map<std::string_view, const block_layout *> &block_layouts()
+{
+	// Layouts register during static initialization of other translation units
+	static std::unordered_map<std::string_view, const block_layout *> s_blockLayouts;
+	return s_blockLayouts;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+const block_layout::member *block_layout::find( std::string_view memberName ) const
+{
+	for ( auto &m : members )
+		if ( memberName == m.name )
+			return &m;
+
+	return nullptr;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+void block_layout::validate()
+{
+	unsigned expectedOffset = 0;
+	for ( auto &m : members )
+	{
+		auto alignment = m.alignment;
+		auto totalSize = m.size;
+
+		if ( m.array_size )
+		{
+			if ( packing == block_packing::std140 )
+				alignment = align_up( alignment, 16u );
+
+			m.array_stride = align_up( m.size, alignment );
+			totalSize = m.array_stride * m.array_size;
+
+			if ( m.array_stride != m.size )
+			{
+				log::error( "Block %s: array %s has stride %u in C++, %s expects %u", name, m.name, m.size,
+				            packing == block_packing::std140 ? "std140" : "std430", m.array_stride );
+				valid = false;
+			}
+		}
+
+		expectedOffset = align_up( expectedOffset, alignment );
+		if ( m.offset != expectedOffset )
+		{
+			log::error( "Block %s: member %s is at offset %u in C++, %s expects %u", name, m.name, m.offset,
+			            packing == block_packing::std140 ? "std140" : "std430", expectedOffset );
+			valid = false;
+		}
+
+		expectedOffset = m.offset + totalSize;
+	}
+
+	assert( valid );
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+void block_layout::register_layout( const block_layout *bl )
+{
+	std::scoped_lock lock( block_layouts_mutex() );
+
+	auto [iter, inserted] = block_layouts().emplace( bl->name, bl );
+	if ( !inserted && iter->second != bl )
+		log::error( "Block %s is described by more than one C++ struct", bl->name );
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+bool block_layout::validate_program( unsigned programID )
+{
+	std::scoped_lock lock( block_layouts_mutex() );
+
+	bool result = true;
+	for ( auto blockInterface : { gl_enum::UNIFORM_BLOCK, gl_enum::SHADER_STORAGE_BLOCK } )
+	{
+		auto variableInterface = ( blockInterface == gl_enum::UNIFORM_BLOCK ) ? gl_enum::UNIFORM : gl_enum::BUFFER_VARIABLE;
+
+		int numBlocks = 0, maxNameLength = 0, maxVariableNameLength = 0;
+		gl.GetProgramInterfaceiv( programID, blockInterface, gl_enum::ACTIVE_RESOURCES, &numBlocks );
+		gl.GetProgramInterfaceiv( programID, blockInterface, gl_enum::MAX_NAME_LENGTH, &maxNameLength );
+		gl.GetProgramInterfaceiv( programID, variableInterface, gl_enum::MAX_NAME_LENGTH, &maxVariableNameLength );
+
+		std::string blockName( maxNameLength, '\0' );
+		std::string variableName( maxVariableNameLength, '\0' );
+		std::vector<int> variables;
+
+		for ( int i = 0; i < numBlocks; ++i )
+		{
+			int length = 0;
+			gl.GetProgramResourceName( programID, blockInterface, i, maxNameLength, &length, blockName.data() );
+
+			auto iter = block_layouts().find( std::string_view( blockName.data(), length ) );
+			if ( iter == block_layouts().end() )
+				continue;
+
+			auto bl = iter->second;
+			if ( blockInterface == gl_enum::UNIFORM_BLOCK && bl->packing != block_packing::std140 )
+			{
+				log::error( "Block %s: uniform blocks require std140 packing", bl->name );
+				result = false;
+			}
+
+			const gl_enum blockProps[] = { gl_enum::BUFFER_DATA_SIZE, gl_enum::NUM_ACTIVE_VARIABLES };
+			int blockValues[2] = { 0, 0 };
+			gl.GetProgramResourceiv( programID, blockInterface, i, 2, blockProps, 2, nullptr, blockValues );
+
+			if ( bl->size < static_cast<unsigned>( blockValues[0] ) )
+			{
+				log::error( "Block %s: C++ struct has %u bytes, program expects %d", bl->name, bl->size, blockValues[0] );
+				result = false;
+			}
+
+			variables.resize( blockValues[1] );
+			const gl_enum variablesProp = gl_enum::ACTIVE_VARIABLES;
+			gl.GetProgramResourceiv( programID, blockInterface, i, 1, &variablesProp, blockValues[1], nullptr, variables.data() );
+
+			for ( auto v : variables )
+			{
+				gl.GetProgramResourceName( programID, variableInterface, v, maxVariableNameLength, &length, variableName.data() );
+
+				// Cut away instance name & array subscript
+				std::string_view memberName( variableName.data(), length );
+				if ( auto dotPos = memberName.rfind( '.' ); dotPos != std::string_view::npos )
+					memberName = memberName.substr( dotPos + 1 );
+				if ( auto bracketPos = memberName.find( '[' ); bracketPos != std::string_view::npos )
+					memberName = memberName.substr( 0, bracketPos );
+
+				auto m = bl->find( memberName );
+				if ( !m )
+				{
+					log::error( "Block %s: member %.*s is missing in C++ struct", bl->name, static_cast<int>( memberName.length() ), memberName.data() );
+					result = false;
+					continue;
+				}
+
+				const gl_enum variableProps[] = { gl_enum::TYPE, gl_enum::OFFSET, gl_enum::ARRAY_STRIDE };
+				int variableValues[3] = { 0, 0, 0 };
+				gl.GetProgramResourceiv( programID, variableInterface, v, 3, variableProps, 3, nullptr, variableValues );
+
+				if ( static_cast<gl_type>( variableValues[0] ) != m->type ||
+				     static_cast<unsigned>( variableValues[1] ) != m->offset ||
+				     ( m->array_size && static_cast<unsigned>( variableValues[2] ) != m->array_stride ) )
+				{
+					log::error( "Block %s: member %s does not match program (offset %u/%d, stride %u/%d)",
+					            bl->name, m->name, m->offset, variableValues[1], m->array_stride, variableValues[2] );
+					result = false;
+				}
+			}
+		}
+	}
+
+	return result;
+}
+
+} // namespace gl3d::detail
+
 //---------------------------------------------------------------------------------------------------------------------
 buffer::buffer( buffer_usage usage, const void *data, size_t size, bool makeCopy )
 	: _usage( usage )
@@ -171,8 +547,9 @@ void buffer::synchronize()
 			_owner = false;
 		}
 
+		// Storage flags other than MAP_* bits are not valid access flags
 		if ( _usage == buffer_usage::persistent || _usage == buffer_usage::persistent_coherent )
-			_data = reinterpret_cast<uint8_t *>( gl.MapNamedBufferRange( _id, 0, static_cast<unsigned>( _size ), flags ) );
+			_data = reinterpret_cast<uint8_t *>( gl.MapNamedBufferRange( _id, 0, static_cast<unsigned>( _size ), flags & ~( +gl_enum::DYNAMIC_STORAGE_BIT ) ) );
 	}
 }
 
@@ -218,17 +595,123 @@ void buffer::resize( const void *data, size_t length )
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+namespace detail {
+
+const char *s_shaderPrologue460 =
+    "#version 460 core\n"
+    "#extension GL_ARB_gpu_shader_int64 : enable\n";
+
+// Used with 4.5 contexts (Mesa llvmpipe), draw parameters are the only 4.6 core feature shaders rely on
+const char *s_shaderPrologue450 =
+    "#version 450 core\n"
+    "#extension GL_ARB_gpu_shader_int64 : enable\n"
+    "#extension GL_ARB_shader_draw_parameters : enable\n"
+    "#define gl_BaseInstance gl_BaseInstanceARB\n"
+    "#define gl_BaseVertex gl_BaseVertexARB\n"
+    "#define gl_DrawID gl_DrawIDARB\n";
+
+const char *g_shaderPrologue = s_shaderPrologue460;
+
+//---------------------------------------------------------------------------------------------------------------------
+std::string normalize_defines( std::string_view defines )
+{
+	std::vector<std::string> entries;
+
+	size_t cursor = 0;
+	while ( cursor < defines.size() )
+	{
+		auto sepPos = defines.find_first_of( ";,\n", cursor );
+		if ( sepPos == std::string_view::npos )
+			sepPos = defines.size();
+
+		// "NAME = VALUE" and "NAME=VALUE" have to produce the same key
+		if ( auto entry = trim( defines.substr( cursor, sepPos - cursor ) ); !entry.empty() )
+		{
+			auto eqPos = entry.find( '=' );
+			if ( eqPos != std::string_view::npos )
+				entries.push_back( std::string( trim( entry.substr( 0, eqPos ) ) ) + "=" + std::string( trim( entry.substr( eqPos + 1 ) ) ) );
+			else
+				entries.emplace_back( entry );
+		}
+
+		cursor = sepPos + 1;
+	}
+
+	std::sort( entries.begin(), entries.end() );
+	entries.erase( std::unique( entries.begin(), entries.end() ), entries.end() );
+
+	std::string result;
+	for ( auto entry : entries )
+	{
+		if ( !result.empty() )
+			result += ';';
+
+		result += entry;
+	}
+
+	return result;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+std::string defines_to_glsl( std::string_view normalizedDefines )
+{
+	std::string result;
+
+	size_t cursor = 0;
+	while ( cursor < normalizedDefines.size() )
+	{
+		auto sepPos = normalizedDefines.find( ';', cursor );
+		if ( sepPos == std::string_view::npos )
+			sepPos = normalizedDefines.size();
+
+		auto entry = normalizedDefines.substr( cursor, sepPos - cursor );
+		auto eqPos = entry.find( '=' );
+
+		result += "#define ";
+		if ( eqPos != std::string_view::npos )
+		{
+			result += entry.substr( 0, eqPos );
+			result += ' ';
+			result += entry.substr( eqPos + 1 );
+		}
+		else
+			result += entry;
+
+		result += '\n';
+		cursor = sepPos + 1;
+	}
+
+	return result;
+}
+
+}
+
 //---------------------------------------------------------------------------------------------------------------------
-shader::shader( shader_code::ptr code, std::string_view defines )
+shader::shader( shader_code::ptr code, std::string_view defines, const detail::layout *pulledLayout )
 	: _shaderCode( code )
-	, _defines( defines )
+	, _defines( detail::normalize_defines( defines ) )
+	, _pulledLayout( pulledLayout )
 {
+	if ( _pulledLayout )
+		_pullingSource = detail::vertex_pulling_source( *_pulledLayout );
 
+	if ( _shaderCode )
+	{
+		std::scoped_lock lock( _shaderCode->_programsMutex );
+		_shaderCode->_programs.push_back( this );
+	}
 }
 
 //---------------------------------------------------------------------------------------------------------------------
 shader::~shader()
 {
+	if ( _shaderCode )
+	{
+		std::scoped_lock lock( _shaderCode->_programsMutex );
+		auto &programs = _shaderCode->_programs;
+		programs.erase( std::remove( programs.begin(), programs.end(), this ), programs.end() );
+	}
+
 	clear();
 }
 
@@ -242,12 +725,92 @@ void shader::clear()
 	}
 
 	gl.DeleteProgram( _id );
+	gl.DeleteProgram( _previousID );
 	_id = 0;
+	_previousID = 0;
+	_status = shader_status::not_compiled;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+uint64_t shader::binary_key() const
+{
+	// Driver identification is part of the key, binaries are not portable between drivers
+	static const std::string s_driverString = [&]()
+	{
+		std::string result;
+		for ( auto name : { GL_VENDOR, GL_RENDERER, GL_VERSION } )
+		{
+			if ( auto str = reinterpret_cast<const char *>( glGetString( name ) ) )
+				result += str;
+
+			result += '\n';
+		}
+
+		return result;
+	}();
+
+	uint64_t result = 14695981039346656037ull;
+	auto combine = [&]( std::string_view text )
+	{
+		for ( auto ch : text )
+		{
+			result ^= static_cast<uint8_t>( ch );
+			result *= 1099511628211ull;
+		}
+
+		// Separator, so moving text between parts changes the key
+		result ^= 0xFFu;
+		result *= 1099511628211ull;
+	};
+
+	combine( s_driverString );
+	combine( _defines );
+	combine( _pullingSource );
+
+	for ( size_t i = 0; i < +shader_stage::__count; ++i )
+		combine( _shaderCode->stage_source( static_cast<shader_stage>( i ) ) );
+
+	return result;
 }
 
 //---------------------------------------------------------------------------------------------------------------------
 bool shader::compile()
 {
+	GL3D_PROFILE_ZONE( "shader::compile" );
+	compile_async();
+
+	if ( _status == shader_status::compiling )
+		finish_compile();
+
+	return _status == shader_status::ready;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+void shader::compile_async()
+{
+	if ( _status == shader_status::compiling )
+		return;
+
+	_binaryKey = binary_key();
+	if ( auto programID = program_cache::load( _binaryKey ) )
+	{
+		clear();
+		_id = programID;
+		_status = shader_status::ready;
+
+		// C++ structs may have changed since the binary was saved
+		if ( !detail::block_layout::validate_program( _id ) )
+		{
+			program_cache::remove( _binaryKey );
+			clear();
+			_status = shader_status::failed;
+		}
+
+		return;
+	}
+
+	auto glslDefines = detail::defines_to_glsl( _defines );
+
 	for ( size_t i = 0; i < +shader_stage::__count; ++i )
 	{
 		auto &src = _shaderCode->stage_source( static_cast<shader_stage>( i ) );
@@ -270,103 +833,558 @@ bool shader::compile()
 			_stageIDs[i] = gl.CreateShader( glTypes[i] );
 		}
 
-		auto srcData = src.c_str();
-		gl.ShaderSource( _stageIDs[i], 1, &srcData, nullptr );
-		gl.CompileShader( _stageIDs[i] );
+		// Defines go right after the prologue, #version has to stay first
+		std::string_view prologue = detail::g_shaderPrologue;
+		assert( std::string_view( src ).substr( 0, prologue.size() ) == prologue );
 
-		int compileStatus;
-		gl.GetShaderiv( _stageIDs[i], gl_enum::COMPILE_STATUS, &compileStatus );
-		if ( !compileStatus )
-		{
-			int logLength;
-			gl.GetShaderiv( _stageIDs[i], gl_enum::INFO_LOG_LENGTH, &logLength );
+		// Generated fetch code goes only to vertex stage, right before the first line of the source
+		bool pulling = ( i == +shader_stage::vertex ) && _pulledLayout;
 
-			std::unique_ptr<char[]> text = std::make_unique<char[]>( logLength + 1 );
-			gl.GetShaderInfoLog( _stageIDs[i], logLength, nullptr, text.get() );
-			text[logLength] = 0;
+		const char *srcParts[] = { src.c_str(), glslDefines.c_str(), _pullingSource.c_str(), src.c_str() + prologue.size() };
+		int srcLengths[] =
+		{
+			static_cast<int>( prologue.size() ),
+			static_cast<int>( glslDefines.size() ),
+			pulling ? static_cast<int>( _pullingSource.size() ) : 0,
+			static_cast<int>( src.size() - prologue.size() )
+		};
 
-			log::error( "%s", text.get() );
-			return false;
-		}
+		// Status is not queried here, that would wait for the compiler
+		gl.ShaderSource( _stageIDs[i], 4, srcParts, srcLengths );
+		gl.CompileShader( _stageIDs[i] );
 	}
 
 	if ( !_id )
 		_id = gl.CreateProgram();
 
+	gl.ProgramParameteri( _id, gl_enum::PROGRAM_BINARY_RETRIEVABLE_HINT, 1 );
+
 	for ( auto stageID : _stageIDs ) if ( stageID ) gl.AttachShader( _id, stageID );
 	gl.LinkProgram( _id );
 	for ( auto stageID : _stageIDs ) if ( stageID ) gl.DetachShader( _id, stageID );
 
-	int linkStatus;
-	gl.GetProgramiv( _id, gl_enum::LINK_STATUS, &linkStatus );
-	if ( !linkStatus )
-	{
-		int logLength;
-		gl.GetProgramiv( _id, gl_enum::INFO_LOG_LENGTH, &logLength );
+	_status = shader_status::compiling;
+}
 
-		std::unique_ptr<char[]> text = std::make_unique<char[]>( logLength + 1 );
-		gl.GetProgramInfoLog( _id, logLength, nullptr, text.get() );
+//---------------------------------------------------------------------------------------------------------------------
+shader_status shader::status()
+{
+	if ( _status == shader_status::compiling )
+	{
+		if ( detail::tl_currentContext && detail::tl_currentContext->parallel_shader_compile() )
+		{
+			int completed = 0;
+			gl.GetProgramiv( _id, gl_enum::COMPLETION_STATUS_KHR, &completed );
+			if ( !completed )
+				return _status;
+		}
+
+		finish_compile();
+	}
+
+	return _status;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+void shader::invalidate()
+{
+	// Linked program is kept for binding until the recompiled one is ready, compile_async() links a new one
+	if ( _status == shader_status::ready )
+	{
+		program_cache::remove( _binaryKey );
+
+		assert( !_previousID );
+		_previousID = _id;
+		_id = 0;
+	}
+
+	_status = shader_status::not_compiled;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+bool shader::finish_compile()
+{
+	for ( auto stageID : _stageIDs )
+	{
+		if ( !stageID )
+			continue;
+
+		int compileStatus;
+		gl.GetShaderiv( stageID, gl_enum::COMPILE_STATUS, &compileStatus );
+		if ( !compileStatus )
+		{
+			int logLength;
+			gl.GetShaderiv( stageID, gl_enum::INFO_LOG_LENGTH, &logLength );
+
+			std::unique_ptr<char[]> text = std::make_unique<char[]>( logLength + 1 );
+			gl.GetShaderInfoLog( stageID, logLength, nullptr, text.get() );
+			text[logLength] = 0;
+
+			log::error( "%s", text.get() );
+
+			// Errors may come from the generated part, which the user never sees otherwise
+			if ( _pulledLayout && stageID == _stageIDs[+shader_stage::vertex] )
+				log::error( "Generated vertex pulling code:\n%s", _pullingSource.c_str() );
+
+			clear();
+			_status = shader_status::failed;
+			return false;
+		}
+	}
+
+	int linkStatus;
+	gl.GetProgramiv( _id, gl_enum::LINK_STATUS, &linkStatus );
+	if ( !linkStatus )
+	{
+		int logLength;
+		gl.GetProgramiv( _id, gl_enum::INFO_LOG_LENGTH, &logLength );
+
+		std::unique_ptr<char[]> text = std::make_unique<char[]>( logLength + 1 );
+		gl.GetProgramInfoLog( _id, logLength, nullptr, text.get() );
 		text[logLength] = 0;
 
 		log::error( "%s", text.get() );
 		clear();
+		_status = shader_status::failed;
 		return false;
 	}
 
+	// Program with blocks not matching their C++ structs would read garbage, treat it as a link error
+	if ( !detail::block_layout::validate_program( _id ) )
+	{
+		clear();
+		_status = shader_status::failed;
+		return false;
+	}
+
+	program_cache::save( _binaryKey, _id );
+	gl.DeleteProgram( _previousID );
+	_previousID = 0;
+	_status = shader_status::ready;
 	return true;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+namespace detail {
+
+std::mutex g_shaderCompilerMutex;
+std::vector<shader::ptr> g_pendingShaders;
+shader::ptr g_placeholderShader;
+
+}
+
 //---------------------------------------------------------------------------------------------------------------------
-bool shader_code::source( std::string_view sourceCode, const std::filesystem::path &cwd )
+void shader_compiler::max_threads( unsigned count )
 {
-	std::stringstream ss;
-	if ( !detail::unroll_includes( ss, sourceCode, cwd ) )
-		return false;
+	if ( detail::tl_currentContext && detail::tl_currentContext->parallel_shader_compile() )
+		gl.MaxShaderCompilerThreadsKHR( count );
+}
 
-	for ( auto &stageSource : _stageSources )
-		stageSource.clear();
+//---------------------------------------------------------------------------------------------------------------------
+void shader_compiler::submit( const detail::type_range<shader::ptr> &shaders )
+{
+	std::scoped_lock lock( detail::g_shaderCompilerMutex );
 
-	std::string sharedSource =
-	    "#version 460 core\n"
-	    "#extension GL_ARB_gpu_shader_int64 : enable\n";
+	for ( size_t i = 0; i < shaders.size; ++i )
+	{
+		auto &sh = shaders.data[i];
+		if ( !sh || sh->status() != shader_status::not_compiled )
+			continue;
+
+		sh->compile_async();
+		detail::g_pendingShaders.push_back( sh );
+	}
+}
 
-	std::string *currentStage = &sharedSource;
+//---------------------------------------------------------------------------------------------------------------------
+size_t shader_compiler::pending()
+{
+	std::scoped_lock lock( detail::g_shaderCompilerMutex );
 
-	_unrolledSource = ss.str();
-	detail::for_each_line( _unrolledSource, [&]( std::string_view line, unsigned lineNum )
+	auto &shaders = detail::g_pendingShaders;
+	shaders.erase( std::remove_if( shaders.begin(), shaders.end(), []( const shader::ptr & sh )
 	{
-		bool addLine = true;
+		return sh->status() != shader_status::compiling;
+	} ), shaders.end() );
+
+	return shaders.size();
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+void shader_compiler::placeholder( shader::ptr sh )
+{
+	std::scoped_lock lock( detail::g_shaderCompilerMutex );
+	detail::g_placeholderShader = sh;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+shader::ptr shader_compiler::placeholder()
+{
+	std::scoped_lock lock( detail::g_shaderCompilerMutex );
+	return detail::g_placeholderShader;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace detail {
+
+std::mutex g_programCacheMutex;
+std::filesystem::path g_programCacheDirectory;
+
+//---------------------------------------------------------------------------------------------------------------------
+/// @brief Written as raw bytes, members are ordered and padded explicitly so no compiler padding ends up in the file
+struct program_binary_header
+{
+	uint32_t magic = make_four_cc( 'G', 'L', '3', 'D' );
+	uint32_t binary_format = 0;
+	uint64_t key = 0;
+	uint32_t length = 0;
+	uint32_t reserved = 0;
+};
+
+static_assert( sizeof( program_binary_header ) == 24, "Program binary header must not contain implicit padding" );
+
+//---------------------------------------------------------------------------------------------------------------------
+std::filesystem::path program_binary_path( uint64_t key )
+{
+	std::scoped_lock lock( g_programCacheMutex );
+	if ( g_programCacheDirectory.empty() )
+		return std::filesystem::path();
+
+	char fileName[32];
+	snprintf( fileName, sizeof( fileName ), "%016llx.bin", static_cast<unsigned long long>( key ) );
+	return g_programCacheDirectory / fileName;
+}
 
-		if ( auto dir = detail::trim( line ); !dir.empty() && dir[0] == '#' )
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+void program_cache::directory( const std::filesystem::path &path )
+{
+	std::scoped_lock lock( detail::g_programCacheMutex );
+	detail::g_programCacheDirectory = path;
+
+	if ( !path.empty() )
+	{
+		std::error_code ec;
+		std::filesystem::create_directories( path, ec );
+	}
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+std::filesystem::path program_cache::directory()
+{
+	std::scoped_lock lock( detail::g_programCacheMutex );
+	return detail::g_programCacheDirectory;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+unsigned program_cache::load( uint64_t key )
+{
+	auto path = detail::program_binary_path( key );
+	if ( path.empty() )
+		return 0;
+
+	std::error_code ec;
+	auto fileSize = std::filesystem::file_size( path, ec );
+	if ( ec || fileSize < sizeof( detail::program_binary_header ) )
+		return 0;
+
+	std::ifstream ifs( path, std::ios_base::in | std::ios_base::binary );
+	if ( !ifs.is_open() )
+		return 0;
+
+	detail::program_binary_header header, expected;
+	if ( !ifs.read( reinterpret_cast<char *>( &header ), sizeof( header ) ) || header.magic != expected.magic || header.key != key )
+		return 0;
+
+	// Truncated or corrupted file, length must not be trusted before allocating
+	if ( header.length == 0 || header.length != fileSize - sizeof( header ) || header.length > INT_MAX )
+	{
+		log::warning( "Ignoring corrupted program binary: %s", path.string().c_str() );
+		return 0;
+	}
+
+	auto binary = std::make_unique<uint8_t[]>( header.length );
+	if ( !ifs.read( reinterpret_cast<char *>( binary.get() ), header.length ) )
+		return 0;
+
+	auto programID = gl.CreateProgram();
+	gl.ProgramBinary( programID, header.binary_format, binary.get(), static_cast<int>( header.length ) );
+
+	// Driver may reject binaries after an update, caller falls back to compiling from source
+	int linkStatus;
+	gl.GetProgramiv( programID, gl_enum::LINK_STATUS, &linkStatus );
+	if ( !linkStatus )
+	{
+		gl.DeleteProgram( programID );
+		std::filesystem::remove( path, ec );
+		return 0;
+	}
+
+	return programID;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+void program_cache::save( uint64_t key, unsigned programID )
+{
+	auto path = detail::program_binary_path( key );
+	if ( path.empty() )
+		return;
+
+	int length = 0;
+	gl.GetProgramiv( programID, gl_enum::PROGRAM_BINARY_LENGTH, &length );
+	if ( length <= 0 )
+		return;
+
+	detail::program_binary_header header;
+	header.key = key;
+
+	auto binary = std::make_unique<uint8_t[]>( length );
+	gl.GetProgramBinary( programID, length, &length, &header.binary_format, binary.get() );
+	header.length = static_cast<uint32_t>( length );
+
+	std::ofstream ofs( path, std::ios_base::out | std::ios_base::binary | std::ios_base::trunc );
+	if ( !ofs.is_open() )
+	{
+		log::warning( "Could not write program binary: %s", path.string().c_str() );
+		return;
+	}
+
+	ofs.write( reinterpret_cast<const char *>( &header ), sizeof( header ) );
+	ofs.write( reinterpret_cast<const char *>( binary.get() ), header.length );
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+void program_cache::remove( uint64_t key )
+{
+	if ( auto path = detail::program_binary_path( key ); !path.empty() )
+	{
+		std::error_code ec;
+		std::filesystem::remove( path, ec );
+	}
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+void program_cache::clear()
+{
+	auto dir = directory();
+	if ( dir.empty() )
+		return;
+
+	std::error_code ec;
+	for ( auto &entry : std::filesystem::directory_iterator( dir, ec ) )
+		if ( entry.path().extension() == ".bin" )
+			std::filesystem::remove( entry.path(), ec );
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+//---------------------------------------------------------------------------------------------------------------------
+namespace detail {
+
+std::mutex g_shaderCodesMutex;
+std::vector<shader_code *> g_shaderCodes;
+
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+shader_code::shader_code()
+{
+	std::scoped_lock lock( detail::g_shaderCodesMutex );
+	detail::g_shaderCodes.push_back( this );
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+shader_code::~shader_code()
+{
+	std::scoped_lock lock( detail::g_shaderCodesMutex );
+	auto &codes = detail::g_shaderCodes;
+	codes.erase( std::remove( codes.begin(), codes.end(), this ), codes.end() );
+}
+
+namespace detail {
+
+std::mutex g_includeCacheMutex;
+std::unordered_map<std::string, std::shared_ptr<const bytes_t>> g_includeCache;
+
+//---------------------------------------------------------------------------------------------------------------------
+std::shared_ptr<const bytes_t> load_include( const std::filesystem::path &path )
+{
+	auto key = path.generic_string();
+	{
+		std::scoped_lock lock( g_includeCacheMutex );
+		if ( auto iter = g_includeCache.find( key ); iter != g_includeCache.end() )
+			return iter->second;
+	}
+
+	auto bytes = std::make_shared<bytes_t>();
+	if ( !vfs::load( path, *bytes ) )
+		return nullptr;
+
+	std::scoped_lock lock( g_includeCacheMutex );
+	return g_includeCache.emplace( key, std::move( bytes ) ).first->second;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+void forget_include( const std::filesystem::path &path )
+{
+	std::scoped_lock lock( g_includeCacheMutex );
+	g_includeCache.erase( path.lexically_normal().generic_string() );
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+struct shader_preprocessor
+{
+	static constexpr unsigned max_include_depth = 32;
+
+	std::string shared = "#line 1 0\n";
+	std::string stages[+shader_stage::__count];
+	std::string *current = &shared;
+	files_t includes;
+	unsigned depth = 0;
+
+	void line_directive( unsigned line, unsigned sourceIndex )
+	{
+		char text[32];
+		snprintf( text, sizeof( text ), "#line %u %u\n", line, sourceIndex );
+		*current += text;
+	}
+
+	void stage( shader_stage s, unsigned nextLine, unsigned sourceIndex )
+	{
+		current = &stages[+s];
+		line_directive( nextLine, sourceIndex );
+	}
+
+	bool include( std::string_view argument, const std::filesystem::path &cwd, unsigned lineNum )
+	{
+		bool isRelative = false;
+		if ( argument.length() >= 2 && argument[0] == '"' && argument.back() == '"' )
+			isRelative = true;
+		else if ( argument.length() >= 2 && argument[0] == '<' && argument.back() == '>' )
+			isRelative = false;
+		else
 		{
-			dir = detail::trim( dir.substr( 1 ) ); // Cut away '#' & trim
-			if ( detail::starts_with_nocase( dir, "vertex", "vert", "vs" ) )
-			{
-				addLine = false;
-				currentStage = &_stageSources[+shader_stage::vertex];
-			}
-			else if ( detail::starts_with_nocase( dir, "fragment", "frag", "fs", "pixel" ) )
-			{
-				addLine = false;
-				currentStage = &_stageSources[+shader_stage::fragment];
-			}
+			log::error( "Invalid include directive at line %u", lineNum );
+			return false;
 		}
 
-		if ( addLine )
+		std::filesystem::path path = trim( argument.substr( 1, argument.length() - 2 ) );
+		if ( isRelative )
+			path = cwd / path;
+
+		path = path.lexically_normal();
+
+		auto iter = std::find( includes.begin(), includes.end(), path );
+		auto sourceIndex = static_cast<unsigned>( iter - includes.begin() ) + 1;
+		if ( iter == includes.end() )
+			includes.push_back( path );
+
+		auto bytes = load_include( path );
+		if ( !bytes )
 		{
-			*currentStage += line;
-			*currentStage += detail::s_lineSeparator;
+			log::error( "Could not open file stream: %s", path.string().c_str() );
+			return false;
 		}
-	} );
 
-	for ( auto &stageSource : _stageSources )
-		if ( !stageSource.empty() )
-			stageSource = ( sharedSource + stageSource );
+		if ( depth >= max_include_depth )
+		{
+			log::error( "Include depth limit reached, recursive include of: %s", path.string().c_str() );
+			return false;
+		}
+
+		++depth;
+		line_directive( 1, sourceIndex );
+		bool result = process( std::string_view( reinterpret_cast<const char *>( bytes->data() ), bytes->size() ), path.parent_path(), sourceIndex );
+		--depth;
+
+		return result;
+	}
+
+	bool process( std::string_view text, const std::filesystem::path &cwd, unsigned sourceIndex )
+	{
+		size_t cursor = 0;
+		unsigned lineNum = 0;
+		while ( cursor < text.length() )
+		{
+			auto sepPos = text.find( '\n', cursor );
+			if ( sepPos == std::string_view::npos )
+				sepPos = text.length();
+
+			auto line = text.substr( cursor, sepPos - cursor );
+			cursor = sepPos + 1;
+			++lineNum;
+
+			if ( auto dir = trim( line ); !dir.empty() && dir[0] == '#' )
+			{
+				dir = trim( dir.substr( 1 ) ); // Cut away '#' & trim
+				if ( starts_with_nocase( dir, "include" ) )
+				{
+					if ( !include( trim( dir.substr( 7 ) ), cwd, lineNum ) )
+						return false;
+
+					line_directive( lineNum + 1, sourceIndex );
+					continue;
+				}
+				else if ( starts_with_nocase( dir, "vertex", "vert", "vs" ) )
+				{
+					stage( shader_stage::vertex, lineNum + 1, sourceIndex );
+					continue;
+				}
+				else if ( starts_with_nocase( dir, "fragment", "frag", "fs", "pixel" ) )
+				{
+					stage( shader_stage::fragment, lineNum + 1, sourceIndex );
+					continue;
+				}
+				else if ( starts_with_nocase( dir, "compute", "comp", "cs" ) )
+				{
+					stage( shader_stage::compute, lineNum + 1, sourceIndex );
+					continue;
+				}
+			}
+
+			*current += line;
+			*current += '\n';
+		}
+
+		return true;
+	}
+};
+
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+bool shader_code::source( std::string_view sourceCode, const std::filesystem::path &cwd )
+{
+	// Sources loaded from streams are null terminated
+	while ( !sourceCode.empty() && !sourceCode.back() )
+		sourceCode.remove_suffix( 1 );
+
+	detail::shader_preprocessor pp;
+	if ( !pp.process( sourceCode, cwd, 0 ) )
+		return false;
+
+	std::string_view prologue = detail::g_shaderPrologue;
+	for ( size_t i = 0; i < +shader_stage::__count; ++i )
+	{
+		auto &stageSource = _stageSources[i];
+		stageSource.clear();
+
+		if ( pp.stages[i].empty() )
+			continue;
+
+		stageSource.reserve( prologue.size() + pp.shared.size() + pp.stages[i].size() );
+		stageSource += prologue;
+		stageSource += pp.shared;
+		stageSource += pp.stages[i];
+	}
 
 	_path.clear();
+	_cwd = cwd;
 	_source = sourceCode;
+	_includes = std::move( pp.includes );
 	return true;
 }
 
@@ -393,10 +1411,219 @@ bool shader_code::load( const std::filesystem::path &path )
 	return true;
 }
 
+//---------------------------------------------------------------------------------------------------------------------
+shader::ptr shader_code::variant( std::string_view defines )
+{
+	auto key = detail::normalize_defines( defines );
+
+	std::scoped_lock lock( _variantsMutex );
+	auto &cached = _variants[key];
+
+	auto result = cached.lock();
+	if ( !result )
+	{
+		result = shader::create( shared_from_this(), key );
+		cached = result;
+	}
+
+	return result;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+void shader_code::clear_variants()
+{
+	std::scoped_lock lock( _variantsMutex );
+	_variants.clear();
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+bool shader_code::depends_on( const std::filesystem::path &path ) const
+{
+	auto normalized = path.lexically_normal();
+	if ( !_path.empty() && _path.lexically_normal() == normalized )
+		return true;
+
+	return std::find( _includes.begin(), _includes.end(), normalized ) != _includes.end();
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+size_t shader_code::file_changed( const std::filesystem::path &path )
+{
+	size_t result = 0;
+
+	std::scoped_lock lock( detail::g_shaderCodesMutex );
+	for ( auto *code : detail::g_shaderCodes )
+	{
+		if ( !code->depends_on( path ) )
+			continue;
+
+		detail::forget_include( path );
+
+		// Copies, reloading overwrites both
+		auto codePath = code->_path;
+		auto codeSource = code->_source;
+
+		bool reloaded = codePath.empty() ? code->source( codeSource, code->_cwd ) : code->load( codePath );
+		if ( !reloaded )
+		{
+			// Keep using programs built from the previous version
+			log::error( "Could not reload shader code depending on: %s", path.string().c_str() );
+			continue;
+		}
+
+		std::scoped_lock programsLock( code->_programsMutex );
+		for ( auto *sh : code->_programs )
+			sh->invalidate();
+
+		result += code->_programs.size();
+	}
+
+	return result;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace detail {
+
+std::mutex g_samplerCacheMutex;
+std::unordered_map<sampler_state, sampler::ptr, sampler_state::hasher> g_samplerCache;
+
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+size_t sampler_state::hash() const
+{
+	// FNV-1a over all state members
+	uint64_t result = 14695981039346656037ull;
+	auto combine = [&]( unsigned value )
+	{
+		result ^= value;
+		result *= 1099511628211ull;
+	};
+
+	for ( auto w : wrap ) combine( +w );
+	for ( auto f : filter ) combine( +f );
+
+	for ( auto f : { max_anisotropy, min_lod } )
+	{
+		unsigned bits;
+		memcpy( &bits, &f, sizeof( unsigned ) );
+		combine( bits );
+	}
+
+	return static_cast<size_t>( result );
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+sampler::ptr sampler::get( const sampler_state &state )
+{
+	std::scoped_lock lock( detail::g_samplerCacheMutex );
+
+	auto &result = detail::g_samplerCache[state];
+	if ( !result )
+		result = std::make_shared<sampler>( state );
+
+	return result;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+void sampler::release_unused()
+{
+	std::scoped_lock lock( detail::g_samplerCacheMutex );
+
+	// E.g. LOD clamps of streamed textures, every streamed level asks for another one
+	for ( auto iter = detail::g_samplerCache.begin(); iter != detail::g_samplerCache.end(); )
+	{
+		if ( iter->second.use_count() == 1 )
+			iter = detail::g_samplerCache.erase( iter );
+		else
+			++iter;
+	}
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+void sampler::release_cache( bool current )
+{
+	std::scoped_lock lock( detail::g_samplerCacheMutex );
+
+	for ( auto &kvp : detail::g_samplerCache )
+	{
+		auto &smp = kvp.second;
+		if ( current && smp->_id )
+			gl.DeleteSamplers( 1, &smp->_id );
+
+		// Textures may still hold the sampler, its destructor must not touch GL anymore
+		smp->_id = 0;
+	}
+
+	detail::g_samplerCache.clear();
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+sampler::sampler( const sampler_state &state )
+	: _state( state )
+{
+
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+sampler::~sampler()
+{
+	if ( _id )
+		gl.DeleteSamplers( 1, &_id );
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+void sampler::synchronize()
+{
+	std::scoped_lock lock( _mutex );
+	if ( _id )
+		return;
+
+	gl.CreateSamplers( 1, &_id );
+	gl.SamplerParameteri( _id, gl_enum::TEXTURE_WRAP_S, static_cast<int>( _state.wrap[0] ) );
+	gl.SamplerParameteri( _id, gl_enum::TEXTURE_WRAP_T, static_cast<int>( _state.wrap[1] ) );
+	gl.SamplerParameteri( _id, gl_enum::TEXTURE_WRAP_R, static_cast<int>( _state.wrap[2] ) );
+	gl.SamplerParameteri( _id, gl_enum::TEXTURE_MIN_FILTER, static_cast<int>( _state.filter[0] ) );
+	gl.SamplerParameteri( _id, gl_enum::TEXTURE_MAG_FILTER, static_cast<int>( _state.filter[1] ) );
+	gl.SamplerParameterf( _id, gl_enum::TEXTURE_MAX_ANISOTROPY, _state.max_anisotropy );
+	gl.SamplerParameterf( _id, gl_enum::TEXTURE_MIN_LOD, _state.min_lod );
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 namespace detail {
 
+// Number of frames a handle has to stay unused before it can be evicted, GPU may still be reading it
+constexpr unsigned k_residencyLatency = 3;
+
+// Mip levels up to this size are uploaded together when streamed texture is created
+constexpr unsigned k_streamingTailSize = 64;
+
+// Residency of a handle is tracked by one bit per context
+constexpr unsigned k_maxResidencySlots = 64;
+
+// Number of frames handle of a texture + sampler pair can stay unused before it gets retired
+constexpr unsigned k_samplerHandleMaxUnusedFrames = 60;
+
+struct retired_handle
+{
+	sampler::ptr smp; // Handle is valid only as long as its sampler object
+	uint64_t handle = 0;
+	unsigned slot = 0;
+	unsigned frame = 0; // Frame the handle was used last time
+	unsigned texture = 0; // Deleting the texture deletes the handle as well
+};
+
+std::mutex g_residencyMutex;
+std::vector<texture *> g_residentTextures;
+std::vector<retired_handle> g_retiredHandles; // Waiting to be made non-resident by the context of the slot
+uint64_t g_residencySlots = 0;
+size_t g_residencyBudget = 0;
+size_t g_residentSize = 0;
+std::atomic<unsigned> g_residencyFrame = 0;
+
+// Defined after residency state, built-in textures are destroyed first and retire their handles
 std::mutex g_builtInTextureMutex;
 texture::ptr g_whitePixel;
 texture::ptr g_checkerboard;
@@ -486,10 +1713,332 @@ texture::ptr texture::debug_grid()
 			}
 		}
 
-		detail::g_debugGrid = texture::create( gl_internal_format::RGBA8, uvec2{ textureSize, textureSize }, pixels.get() );
+		detail::g_debugGrid = texture::create( gl_internal_format::RGBA8, uvec2{ textureSize, textureSize }, pixels.get() );
+	}
+
+	return detail::g_debugGrid;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace detail {
+
+//---------------------------------------------------------------------------------------------------------------------
+struct texture_file_info
+{
+	gl_internal_format format = gl_internal_format::NONE;
+	uvec2 size;
+	bool build_mips = false;
+	std::vector<const uint8_t *> levels; // Finest mip level first
+};
+
+//---------------------------------------------------------------------------------------------------------------------
+template <typename T>
+bool read_file_struct( const mapped_file &file, size_t offset, T &result )
+{
+	if ( offset + sizeof( T ) > file.size() )
+		return false;
+
+	memcpy( &result, file.data() + offset, sizeof( T ) );
+	return true;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+bool check_texture_file_levels( const texture_file_info &info, unsigned numLevels )
+{
+	if ( !info.size.x || !info.size.y )
+	{
+		log::error( "Texture file has zero size" );
+		return false;
+	}
+
+	// Also keeps level shifts below 32 bits and _mipLevels within what TextureStorage2D accepts
+	if ( numLevels > mip_level_count( { info.size.x, info.size.y, 1 } ) )
+	{
+		log::error( "Texture file has %u mip levels, its size allows %u", numLevels, mip_level_count( { info.size.x, info.size.y, 1 } ) );
+		return false;
+	}
+
+	return true;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+bool add_texture_file_level( const mapped_file &file, texture_file_info &info, size_t offset, size_t length )
+{
+	auto level = static_cast<unsigned>( info.levels.size() );
+	auto expected = image_size( get_internal_format( info.format ),
+	                            maximum( 1, info.size.x >> level ), maximum( 1, info.size.y >> level ) );
+
+	// Offsets come straight from the file, adding them could wrap around
+	if ( length < expected || offset > file.size() || expected > file.size() - offset )
+	{
+		log::error( "Texture file is truncated" );
+		return false;
+	}
+
+	info.levels.push_back( file.data() + offset );
+	return true;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+bool parse_dds( const mapped_file &file, texture_file_info &info )
+{
+	struct dds_pixel_format
+	{
+		uint32_t size, flags, four_cc, rgb_bit_count, r_mask, g_mask, b_mask, a_mask;
+	};
+
+	struct dds_header
+	{
+		uint32_t size, flags, height, width, pitch_or_linear_size, depth, mip_map_count, reserved1[11];
+		dds_pixel_format pf;
+		uint32_t caps, caps2, caps3, caps4, reserved2;
+	};
+
+	struct dds_header_dx10
+	{
+		uint32_t dxgi_format, resource_dimension, misc_flag, array_size, misc_flags2;
+	};
+
+	constexpr uint32_t k_ddsdMipMapCount = 0x20000;
+	constexpr uint32_t k_ddpfFourCC = 0x4;
+	constexpr uint32_t k_ddpfRGB = 0x40;
+	constexpr uint32_t k_ddsCaps2CubeMapOrVolume = 0x200 | 0x200000;
+	constexpr uint32_t k_dx10Texture2D = 3;
+
+	static const std::unordered_map<uint32_t, gl_internal_format> s_dxgiFormats =
+	{
+		{ 2, gl_internal_format::RGBA32F },
+		{ 10, gl_internal_format::RGBA16F },
+		{ 28, gl_internal_format::RGBA8 },
+		{ 29, gl_internal_format::SRGB8_ALPHA8 },
+		{ 49, gl_internal_format::RG8 },
+		{ 61, gl_internal_format::R8 },
+		{ 71, gl_internal_format::COMPRESSED_RGBA_S3TC_DXT1 },
+		{ 74, gl_internal_format::COMPRESSED_RGBA_S3TC_DXT3 },
+		{ 77, gl_internal_format::COMPRESSED_RGBA_S3TC_DXT5 },
+		{ 80, gl_internal_format::COMPRESSED_RED_RGTC1 },
+		{ 83, gl_internal_format::COMPRESSED_RG_RGTC2 },
+		{ 95, gl_internal_format::COMPRESSED_RGB_BPTC_UNSIGNED_FLOAT },
+		{ 96, gl_internal_format::COMPRESSED_RGB_BPTC_SIGNED_FLOAT },
+		{ 98, gl_internal_format::COMPRESSED_RGBA_BPTC_UNORM },
+		{ 99, gl_internal_format::COMPRESSED_SRGB_ALPHA_BPTC_UNORM },
+	};
+
+	size_t offset = 4;
+	dds_header header;
+	if ( !read_file_struct( file, offset, header ) || header.size != sizeof( dds_header ) )
+	{
+		log::error( "Invalid DDS header" );
+		return false;
+	}
+
+	offset += sizeof( dds_header );
+
+	if ( header.caps2 & k_ddsCaps2CubeMapOrVolume )
+	{
+		log::error( "DDS cube maps and volume textures are not supported" );
+		return false;
+	}
+
+	if ( header.pf.flags & k_ddpfFourCC )
+	{
+		switch ( header.pf.four_cc )
+		{
+			case make_four_cc( 'D', 'X', 'T', '1' ): info.format = gl_internal_format::COMPRESSED_RGBA_S3TC_DXT1; break;
+			case make_four_cc( 'D', 'X', 'T', '3' ): info.format = gl_internal_format::COMPRESSED_RGBA_S3TC_DXT3; break;
+			case make_four_cc( 'D', 'X', 'T', '5' ): info.format = gl_internal_format::COMPRESSED_RGBA_S3TC_DXT5; break;
+			case make_four_cc( 'A', 'T', 'I', '1' ):
+			case make_four_cc( 'B', 'C', '4', 'U' ): info.format = gl_internal_format::COMPRESSED_RED_RGTC1; break;
+			case make_four_cc( 'A', 'T', 'I', '2' ):
+			case make_four_cc( 'B', 'C', '5', 'U' ): info.format = gl_internal_format::COMPRESSED_RG_RGTC2; break;
+
+			case make_four_cc( 'D', 'X', '1', '0' ):
+			{
+				dds_header_dx10 dx10;
+				if ( !read_file_struct( file, offset, dx10 ) )
+				{
+					log::error( "Invalid DDS header" );
+					return false;
+				}
+
+				offset += sizeof( dds_header_dx10 );
+
+				if ( dx10.resource_dimension != k_dx10Texture2D || dx10.array_size > 1 )
+				{
+					log::error( "Only single 2D DDS textures are supported" );
+					return false;
+				}
+
+				if ( auto iter = s_dxgiFormats.find( dx10.dxgi_format ); iter != s_dxgiFormats.end() )
+					info.format = iter->second;
+			}
+			break;
+		}
+	}
+	else if ( ( header.pf.flags & k_ddpfRGB ) && header.pf.rgb_bit_count == 32 &&
+	          header.pf.r_mask == 0x000000FFu && header.pf.g_mask == 0x0000FF00u && header.pf.b_mask == 0x00FF0000u )
+	{
+		info.format = gl_internal_format::RGBA8;
+	}
+
+	if ( info.format == gl_internal_format::NONE )
+	{
+		log::error( "Unsupported DDS pixel format" );
+		return false;
+	}
+
+	info.size = { header.width, header.height };
+	unsigned numLevels = ( header.flags & k_ddsdMipMapCount ) ? maximum( 1u, header.mip_map_count ) : 1;
+	if ( !check_texture_file_levels( info, numLevels ) )
+		return false;
+
+	// Mip levels are stored one after another, finest first
+	for ( unsigned i = 0; i < numLevels; ++i )
+	{
+		auto length = image_size( get_internal_format( info.format ), maximum( 1, info.size.x >> i ), maximum( 1, info.size.y >> i ) );
+		if ( !add_texture_file_level( file, info, offset, length ) )
+			return false;
+
+		offset += length;
+	}
+
+	return true;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+const uint8_t k_ktx2Identifier[12] = { 0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n' };
+
+//---------------------------------------------------------------------------------------------------------------------
+bool parse_ktx2( const mapped_file &file, texture_file_info &info )
+{
+	struct ktx2_header
+	{
+		uint8_t identifier[12];
+		uint32_t vk_format, type_size, pixel_width, pixel_height, pixel_depth;
+		uint32_t layer_count, face_count, level_count, supercompression_scheme;
+		uint32_t dfd_byte_offset, dfd_byte_length, kvd_byte_offset, kvd_byte_length;
+		uint64_t sgd_byte_offset, sgd_byte_length;
+	};
+
+	struct ktx2_level
+	{
+		uint64_t byte_offset, byte_length, uncompressed_byte_length;
+	};
+
+	static const std::unordered_map<uint32_t, gl_internal_format> s_vkFormats =
+	{
+		{ 9, gl_internal_format::R8 },
+		{ 16, gl_internal_format::RG8 },
+		{ 37, gl_internal_format::RGBA8 },
+		{ 43, gl_internal_format::SRGB8_ALPHA8 },
+		{ 97, gl_internal_format::RGBA16F },
+		{ 109, gl_internal_format::RGBA32F },
+		{ 131, gl_internal_format::COMPRESSED_RGB_S3TC_DXT1 },
+		{ 133, gl_internal_format::COMPRESSED_RGBA_S3TC_DXT1 },
+		{ 135, gl_internal_format::COMPRESSED_RGBA_S3TC_DXT3 },
+		{ 137, gl_internal_format::COMPRESSED_RGBA_S3TC_DXT5 },
+		{ 139, gl_internal_format::COMPRESSED_RED_RGTC1 },
+		{ 141, gl_internal_format::COMPRESSED_RG_RGTC2 },
+		{ 143, gl_internal_format::COMPRESSED_RGB_BPTC_UNSIGNED_FLOAT },
+		{ 144, gl_internal_format::COMPRESSED_RGB_BPTC_SIGNED_FLOAT },
+		{ 145, gl_internal_format::COMPRESSED_RGBA_BPTC_UNORM },
+		{ 146, gl_internal_format::COMPRESSED_SRGB_ALPHA_BPTC_UNORM },
+	};
+
+	ktx2_header header;
+	if ( !read_file_struct( file, 0, header ) )
+	{
+		log::error( "Invalid KTX2 header" );
+		return false;
+	}
+
+	if ( header.pixel_depth > 1 || header.layer_count > 1 || header.face_count != 1 )
+	{
+		log::error( "Only single 2D KTX2 textures are supported" );
+		return false;
+	}
+
+	if ( header.supercompression_scheme )
+	{
+		log::error( "Supercompressed KTX2 textures are not supported" );
+		return false;
+	}
+
+	if ( auto iter = s_vkFormats.find( header.vk_format ); iter != s_vkFormats.end() )
+		info.format = iter->second;
+	else
+	{
+		log::error( "Unsupported KTX2 format: %u", header.vk_format );
+		return false;
+	}
+
+	info.size = { header.pixel_width, header.pixel_height };
+
+	// Zero level count asks for mip levels to be generated
+	info.build_mips = header.level_count == 0;
+	unsigned numLevels = maximum( 1u, header.level_count );
+	if ( !check_texture_file_levels( info, numLevels ) )
+		return false;
+
+	// Level index is ordered finest first, level data in file is ordered mip tail first
+	for ( unsigned i = 0; i < numLevels; ++i )
+	{
+		ktx2_level level;
+		if ( !read_file_struct( file, sizeof( ktx2_header ) + i * sizeof( ktx2_level ), level ) ||
+		     level.byte_offset > file.size() || level.byte_length > file.size() ||
+		     !add_texture_file_level( file, info, static_cast<size_t>( level.byte_offset ), static_cast<size_t>( level.byte_length ) ) )
+		{
+			log::error( "Invalid KTX2 level index" );
+			return false;
+		}
+	}
+
+	return true;
+}
+
+} // namespace gl3d::detail
+
+//---------------------------------------------------------------------------------------------------------------------
+texture::ptr texture::load( const std::filesystem::path &path )
+{
+	auto file = vfs::map( path );
+	if ( !file || !file->valid() )
+	{
+		log::error( "Could not load texture: %s", path.string().c_str() );
+		return nullptr;
+	}
+
+	detail::texture_file_info info;
+	bool parsed = false;
+
+	if ( file->size() >= 4 && !memcmp( file->data(), "DDS ", 4 ) )
+		parsed = detail::parse_dds( *file, info );
+	else if ( file->size() >= sizeof( detail::k_ktx2Identifier ) &&
+	          !memcmp( file->data(), detail::k_ktx2Identifier, sizeof( detail::k_ktx2Identifier ) ) )
+		parsed = detail::parse_ktx2( *file, info );
+	else
+		log::error( "Unknown texture file format" );
+
+	if ( !parsed )
+	{
+		log::error( "Could not load texture: %s", path.string().c_str() );
+		return nullptr;
 	}
 
-	return detail::g_debugGrid;
+	auto result = texture::create( gl_enum::TEXTURE_2D, info.format, uvec3{ info.size.x, info.size.y, 1 }, info.build_mips );
+	if ( !info.build_mips )
+		result->_mipLevels = static_cast<unsigned>( info.levels.size() );
+
+	// Parts point straight into the mapping, which is kept alive until all levels are uploaded
+	result->_numParts = static_cast<unsigned>( info.levels.size() );
+	result->_parts = std::make_unique<part[]>( result->_numParts );
+
+	for ( unsigned i = 0; i < result->_numParts; ++i )
+		result->_parts[i] = { 0, i, 0, info.levels[i] };
+
+	result->_source = file;
+	return result;
 }
 
 //---------------------------------------------------------------------------------------------------------------------
@@ -498,6 +2047,7 @@ texture::texture( gl_enum type, gl_internal_format format, const uvec3 &dimensio
 	, _format( format )
 	, _dimensions( dimensions )
 	, _owner( false )
+	, _buildMips( hasMips )
 {
 	assert( _dimensions.x > 0 && _dimensions.y > 0 && _dimensions.z > 0 );
 	switch ( _type )
@@ -519,6 +2069,9 @@ texture::texture( gl_enum type, gl_internal_format format, const uvec3 &dimensio
 			_dimensions.z = align_up( _dimensions.z, 6u );
 			break;
 	}
+
+	if ( hasMips )
+		_mipLevels = detail::mip_level_count( { _dimensions.x, _dimensions.y, _type == gl_enum::TEXTURE_3D ? _dimensions.z : 1 } );
 }
 
 //---------------------------------------------------------------------------------------------------------------------
@@ -540,13 +2093,11 @@ texture::texture(
 			auto &p = _parts[i];
 			p = parts.data[i];
 
-			uvec2 size{ maximum( 1, _dimensions.x >> p.mip_level ), maximum( 1, _dimensions.y >> p.mip_level ) };
-			auto rowStride = size.x * internalF.pixel_size;
-
 			if ( makeCopy )
 			{
-				auto *copy = new uint8_t[rowStride * size.y];
-				memcpy( copy, p.data, rowStride * size.y );
+				auto size = detail::image_size( internalF, width( p.mip_level ), height( p.mip_level ) );
+				auto *copy = new uint8_t[size];
+				memcpy( copy, p.data, size );
 				p.data = copy;
 			}
 		}
@@ -556,7 +2107,12 @@ texture::texture(
 //---------------------------------------------------------------------------------------------------------------------
 texture::~texture()
 {
+	make_non_resident();
 	clear();
+
+	// Without a current context the texture went away together with the last one
+	if ( _id && detail::tl_currentContext )
+		gl.DeleteTextures( 1, &_id );
 }
 
 //---------------------------------------------------------------------------------------------------------------------
@@ -565,69 +2121,222 @@ void texture::clear()
 	if ( _owner && _parts && _numParts )
 	{
 		for ( size_t i = 0; i < _numParts; ++i )
-			delete[] _parts[i].data;
+			delete[] static_cast<const uint8_t *>( _parts[i].data );
 	}
 
 	_parts.reset();
 	_numParts = 0;
 	_owner = false;
+	_source = nullptr;
+	_streamedLevel = 0;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+void texture::upload_level( unsigned mipLevel )
+{
+	auto internalF = detail::get_internal_format( _format );
+
+	// Rows of file data & copies are tightly packed, e.g. 2x2 R8 level would be read with padded rows otherwise
+	glPixelStorei( GL_UNPACK_ALIGNMENT, 1 );
+
+	for ( size_t i = 0; i < _numParts; ++i )
+	{
+		auto &p = _parts[i];
+		if ( p.mip_level != mipLevel )
+			continue;
+
+		if ( _type == gl_enum::TEXTURE_2D && internalF.block_size )
+		{
+			gl.CompressedTextureSubImage2D(
+			    _id, p.mip_level,
+			    0, 0, width( p.mip_level ), height( p.mip_level ),
+			    _format, static_cast<int>( detail::image_size( internalF, width( p.mip_level ), height( p.mip_level ) ) ), p.data );
+		}
+		else if ( _type == gl_enum::TEXTURE_2D )
+		{
+			gl.TextureSubImage2D(
+			    _id, p.mip_level,
+			    0, 0, width( p.mip_level ), height( p.mip_level ),
+			    internalF.components, internalF.type, p.data );
+		}
+	}
+
+	glPixelStorei( GL_UNPACK_ALIGNMENT, 4 );
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+void texture::make_resident( unsigned slot )
+{
+	auto bit = 1ull << slot;
+
+	std::scoped_lock lock( detail::g_residencyMutex );
+	_lastUsedFrame = detail::g_residencyFrame;
+
+	for ( size_t i = 0; i < _handles.size(); )
+	{
+		auto &sh = _handles[i];
+
+		// Texture is sampled with another sampler now, the handle would stay resident for nothing
+		if ( sh.last_used_frame + detail::k_samplerHandleMaxUnusedFrames < _lastUsedFrame )
+		{
+			retire( sh );
+			sh = std::move( _handles.back() );
+			_handles.pop_back();
+			continue;
+		}
+
+		++i;
+		if ( sh.resident_mask & bit )
+			continue;
+
+		// Handle retired but not flushed yet is still resident in this context, just take it back
+		auto &retired = detail::g_retiredHandles;
+		auto iter = std::find_if( retired.begin(), retired.end(), [&]( const detail::retired_handle &rh )
+		{
+			return rh.handle == sh.handle && rh.slot == slot;
+		} );
+
+		if ( iter != retired.end() )
+		{
+			*iter = std::move( retired.back() );
+			retired.pop_back();
+		}
+		else
+			gl.MakeTextureHandleResidentARB( sh.handle );
+
+		sh.resident_mask |= bit;
+	}
+
+	if ( _resident )
+		return;
+
+	_resident = true;
+
+	detail::g_residentTextures.push_back( this );
+	detail::g_residentSize += memory_size();
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+void texture::make_non_resident()
+{
+	std::scoped_lock lock( detail::g_residencyMutex );
+
+	// Handles are deleted together with the texture, which ends their residency in all contexts
+	auto &retired = detail::g_retiredHandles;
+	retired.erase( std::remove_if( retired.begin(), retired.end(), [this]( const detail::retired_handle &rh )
+	{
+		return rh.texture == _id;
+	} ), retired.end() );
+
+	if ( !_resident )
+		return;
+
+	_resident = false;
+
+	auto &textures = detail::g_residentTextures;
+	if ( auto iter = std::find( textures.begin(), textures.end(), this ); iter != textures.end() )
+	{
+		*iter = textures.back();
+		textures.pop_back();
+	}
+
+	detail::g_residentSize -= memory_size();
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+void texture::retire( sampler_handle &sh )
+{
+	// Contexts make the handle non-resident in their next_frame(), GPU may still read it until then
+	for ( unsigned slot = 0; slot < detail::k_maxResidencySlots; ++slot )
+	{
+		if ( sh.resident_mask & ( 1ull << slot ) )
+			detail::g_retiredHandles.push_back( { sh.smp, sh.handle, slot, _lastUsedFrame, _id } );
+	}
+
+	sh.resident_mask = 0;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+size_t texture::memory_size() const
+{
+	size_t result = detail::image_size( detail::get_internal_format( _format ), _dimensions.x, _dimensions.y ) * _dimensions.z;
+
+	// Full mip chain adds roughly one third
+	return _mipLevels > 1 ? ( result * 4 ) / 3 : result;
 }
 
 //---------------------------------------------------------------------------------------------------------------------
 void texture::wrap( gl_enum u, gl_enum v, gl_enum w )
 {
-	if ( _wrap[0] == u && _wrap[1] == v && _wrap[2] == w )
+	auto &ss = _samplerState;
+	if ( ss.wrap[0] == u && ss.wrap[1] == v && ss.wrap[2] == w )
 		return;
 
-	_wrap[0] = u;
-	_wrap[1] = v;
-	_wrap[2] = w;
-	_dirtySampler = true;
+	ss.wrap[0] = u;
+	ss.wrap[1] = v;
+	ss.wrap[2] = w;
+	_defaultSampler = nullptr;
 }
 
 //---------------------------------------------------------------------------------------------------------------------
 void texture::filter( gl_enum minFilter, gl_enum magFilter )
 {
-	if ( _filter[0] == minFilter && _filter[1] == magFilter )
+	auto &ss = _samplerState;
+	if ( ss.filter[0] == minFilter && ss.filter[1] == magFilter )
 		return;
 
-	_filter[0] = minFilter;
-	_filter[1] = magFilter;
-	_dirtySampler = true;
+	ss.filter[0] = minFilter;
+	ss.filter[1] = magFilter;
+	_defaultSampler = nullptr;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+sampler::ptr texture::default_sampler()
+{
+	if ( !_defaultSampler )
+		_defaultSampler = sampler::get( _samplerState );
+
+	return _defaultSampler;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+sampler::ptr texture::effective_sampler( const sampler::ptr &smp )
+{
+	auto s = smp ? smp : default_sampler();
+	if ( _streamedLevel && s->state().min_lod < _streamedLevel )
+	{
+		auto state = s->state();
+		state.min_lod = static_cast<float>( _streamedLevel );
+		return sampler::get( state );
+	}
+
+	return s;
 }
 
 //---------------------------------------------------------------------------------------------------------------------
-uint64_t texture::synchronize()
+uint64_t texture::synchronize( const sampler::ptr &smp )
 {
+	auto *ctx = detail::tl_currentContext;
+	assert( ctx );
+
+	std::scoped_lock lock( _mutex );
+	unsigned frame = detail::g_residencyFrame;
+
 	if ( !_id )
 	{
 		gl.CreateTextures( _type, 1, &_id );
 
-		auto internalF = detail::get_internal_format( _format );
-		unsigned mipLevels = _buildMips
-		                     ? detail::mip_level_count( { _dimensions.x, _dimensions.y, _dimensions.z } )
-		                     : 1;
-
 		switch ( _type )
 		{
 			case gl_enum::TEXTURE_1D:
 			{
-
+				gl.TextureStorage1D( _id, _mipLevels, _format, _dimensions.x );
 			}
 			break;
 
 			case gl_enum::TEXTURE_2D:
 			{
-				gl.TextureStorage2D( _id, mipLevels, _format, _dimensions.x, _dimensions.y );
-
-				for ( size_t i = 0; i < _numParts; ++i )
-				{
-					auto &p = _parts[i];
-					gl.TextureSubImage2D(
-					    _id, p.mip_level,
-					    0, 0, width( p.mip_level ), height( p.mip_level ),
-					    internalF.components, internalF.type, p.data );
-				}
+				gl.TextureStorage2D( _id, _mipLevels, _format, _dimensions.x, _dimensions.y );
 			}
 			break;
 
@@ -660,32 +2369,359 @@ uint64_t texture::synchronize()
 				break;
 		}
 
-		clear();
-		_dirtySampler = true;
+		if ( _source && !_buildMips )
+		{
+			// Upload mip tail right away, so low resolution version is usable in the first frame
+			_streamedLevel = _mipLevels;
+			do
+				upload_level( --_streamedLevel );
+			while ( _streamedLevel > 0 && maximum( width( _streamedLevel - 1 ), height( _streamedLevel - 1 ) ) <= detail::k_streamingTailSize );
+
+			_lastStreamFrame = frame;
+		}
+		else
+		{
+			for ( unsigned i = 0; i < _mipLevels; ++i )
+				upload_level( i );
+
+			if ( _buildMips )
+				gl.GenerateTextureMipmap( _id );
+		}
+
+		if ( !_streamedLevel )
+			clear();
+
+		// Render threads of other windows sample it from their own contexts
+		glFlush();
+	}
+	else if ( _streamedLevel && _lastStreamFrame != frame )
+	{
+		// Stream in one finer mip level per frame
+		upload_level( --_streamedLevel );
+		_lastStreamFrame = frame;
+
+		if ( !_streamedLevel )
+			clear();
+
+		glFlush();
+
+		// Handles clamping LOD to the previous level would never be asked for again
+		std::scoped_lock residencyLock( detail::g_residencyMutex );
+		for ( size_t i = 0; i < _handles.size(); )
+		{
+			if ( _handles[i].lod_clamp )
+			{
+				retire( _handles[i] );
+				_handles[i] = std::move( _handles.back() );
+				_handles.pop_back();
+			}
+			else
+				++i;
+		}
+	}
+
+	auto s = effective_sampler( smp );
+	s->synchronize();
+
+	auto iter = std::find_if( _handles.begin(), _handles.end(), [&]( const sampler_handle &sh ) { return sh.smp == s; } );
+	uint64_t handle = 0;
+
+	// Every texture + sampler pair gets its own handle, handles are immutable and retired when left unused
+	if ( iter == _handles.end() )
+	{
+		handle = gl.GetTextureSamplerHandleARB( _id, s->id() );
+
+		std::scoped_lock residencyLock( detail::g_residencyMutex );
+		_handles.push_back( { s, handle, 0, frame, s != ( smp ? smp : _defaultSampler ) } );
+	}
+	else
+	{
+		handle = iter->handle;
+		iter->last_used_frame = frame;
+	}
+
+	make_resident( ctx->residency_slot() );
+	return handle;
+}
 
-		if ( _buildMips )
-			gl.GenerateTextureMipmap( _id );
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+//---------------------------------------------------------------------------------------------------------------------
+void texture_residency::budget( size_t bytes )
+{
+	std::scoped_lock lock( detail::g_residencyMutex );
+	detail::g_residencyBudget = bytes;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+size_t texture_residency::budget()
+{
+	std::scoped_lock lock( detail::g_residencyMutex );
+	return detail::g_residencyBudget;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+size_t texture_residency::resident_size()
+{
+	std::scoped_lock lock( detail::g_residencyMutex );
+	return detail::g_residentSize;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+void texture_residency::next_frame()
+{
+	if ( detail::tl_currentContext )
+		sampler::release_unused();
+
+	std::scoped_lock lock( detail::g_residencyMutex );
+	unsigned frame = ++detail::g_residencyFrame;
+
+	if ( !detail::g_residencyBudget || detail::g_residentSize <= detail::g_residencyBudget )
+		return;
+
+	auto &textures = detail::g_residentTextures;
+	std::sort( textures.begin(), textures.end(), []( const texture * a, const texture * b )
+	{
+		return a->_lastUsedFrame < b->_lastUsedFrame;
+	} );
+
+	size_t numEvicted = 0;
+	for ( auto *tex : textures )
+	{
+		if ( detail::g_residentSize <= detail::g_residencyBudget || tex->_lastUsedFrame + detail::k_residencyLatency > frame )
+			break;
+
+		// Called on the main thread, other contexts cannot be touched from here
+		for ( auto &sh : tex->_handles )
+			tex->retire( sh );
+
+		tex->_resident = false;
+		detail::g_residentSize -= tex->memory_size();
+		++numEvicted;
+	}
+
+	textures.erase( textures.begin(), textures.begin() + numEvicted );
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+unsigned texture_residency::acquire_slot()
+{
+	std::scoped_lock lock( detail::g_residencyMutex );
+	for ( unsigned slot = 0; slot < detail::k_maxResidencySlots; ++slot )
+	{
+		if ( !( detail::g_residencySlots & ( 1ull << slot ) ) )
+		{
+			detail::g_residencySlots |= 1ull << slot;
+			return slot;
+		}
+	}
+
+	log::fatal( "Bindless residency is tracked for %u contexts at most", detail::k_maxResidencySlots );
+	return detail::k_maxResidencySlots - 1;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+bool texture_residency::release_slot( unsigned slot )
+{
+	std::scoped_lock lock( detail::g_residencyMutex );
+	auto bit = 1ull << slot;
+
+	// Residency ends together with the context
+	auto &retired = detail::g_retiredHandles;
+	retired.erase( std::remove_if( retired.begin(), retired.end(), [slot]( const detail::retired_handle &rh )
+	{
+		return rh.slot == slot;
+	} ), retired.end() );
+
+	auto &textures = detail::g_residentTextures;
+	for ( size_t i = 0; i < textures.size(); )
+	{
+		auto *tex = textures[i];
+		bool resident = false;
+
+		for ( auto &sh : tex->_handles )
+		{
+			sh.resident_mask &= ~bit;
+			resident = resident || sh.resident_mask;
+		}
+
+		if ( resident )
+		{
+			++i;
+			continue;
+		}
+
+		tex->_resident = false;
+		detail::g_residentSize -= tex->memory_size();
+
+		textures[i] = textures.back();
+		textures.pop_back();
+	}
+
+	detail::g_residencySlots &= ~bit;
+	return !detail::g_residencySlots;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+void texture_residency::flush_retired( unsigned slot )
+{
+	std::scoped_lock lock( detail::g_residencyMutex );
+	auto &retired = detail::g_retiredHandles;
+
+	for ( size_t i = 0; i < retired.size(); )
+	{
+		auto &rh = retired[i];
+		if ( rh.slot == slot && rh.frame + detail::k_residencyLatency <= detail::g_residencyFrame )
+		{
+			gl.MakeTextureHandleNonResidentARB( rh.handle );
+			rh = std::move( retired.back() );
+			retired.pop_back();
+		}
+		else
+			++i;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace detail {
+
+// Number of frames a pooled render target can stay unused before it gets destroyed
+constexpr unsigned k_renderTargetPoolMaxUnusedFrames = 8;
+
+struct pooled_render_target
+{
+	render_target_pool::desc desc;
+	texture::ptr tex;
+	unsigned last_used_frame = 0;
+	bool in_use = false;
+};
+
+std::mutex g_renderTargetPoolMutex;
+std::vector<pooled_render_target> g_renderTargetPool;
+unsigned g_renderTargetPoolFrame = 0;
+
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+texture::ptr render_target_pool::acquire( const desc &d )
+{
+	// Multisampled textures are not supported by gl3d::texture yet
+	assert( d.samples == 1 );
+
+	std::scoped_lock lock( detail::g_renderTargetPoolMutex );
+
+	for ( auto &rt : detail::g_renderTargetPool )
+	{
+		if ( rt.in_use || rt.desc != d )
+			continue;
+
+		rt.in_use = true;
+		rt.last_used_frame = detail::g_renderTargetPoolFrame;
+		return rt.tex;
+	}
+
+	auto &rt = detail::g_renderTargetPool.emplace_back();
+	rt.desc = d;
+	rt.tex = texture::create( d.format, d.size );
+	rt.tex->filter( gl_enum::LINEAR, gl_enum::LINEAR );
+	rt.tex->wrap( gl_enum::CLAMP_TO_EDGE, gl_enum::CLAMP_TO_EDGE, gl_enum::CLAMP_TO_EDGE );
+	rt.last_used_frame = detail::g_renderTargetPoolFrame;
+	rt.in_use = true;
+	return rt.tex;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+void render_target_pool::release( const texture::ptr &tex )
+{
+	std::scoped_lock lock( detail::g_renderTargetPoolMutex );
+
+	for ( auto &rt : detail::g_renderTargetPool )
+	{
+		if ( rt.tex == tex )
+		{
+			rt.in_use = false;
+			return;
+		}
 	}
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+void render_target_pool::next_frame()
+{
+	std::scoped_lock lock( detail::g_renderTargetPoolMutex );
+	auto frame = ++detail::g_renderTargetPoolFrame;
 
-	if ( _dirtySampler && _id )
+	auto &pool = detail::g_renderTargetPool;
+	for ( size_t i = 0; i < pool.size(); )
 	{
-		if ( _bindlessHandle )
-			gl.MakeTextureHandleNonResidentARB( _bindlessHandle );
+		pool[i].in_use = false;
+
+		if ( pool[i].last_used_frame + detail::k_renderTargetPoolMaxUnusedFrames < frame )
+		{
+			std::swap( pool[i], pool.back() );
+			pool.pop_back();
+		}
+		else
+			++i;
+	}
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+size_t render_target_pool::size()
+{
+	std::scoped_lock lock( detail::g_renderTargetPoolMutex );
+	return detail::g_renderTargetPool.size();
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+void render_target_pool::clear()
+{
+	std::scoped_lock lock( detail::g_renderTargetPoolMutex );
+	detail::g_renderTargetPool.clear();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+//---------------------------------------------------------------------------------------------------------------------
+fence::~fence()
+{
+	if ( _sync )
+		gl.DeleteSync( _sync );
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+bool fence::signaled()
+{
+	if ( !_sync )
+		return true;
 
-		gl.TextureParameteri( _id, gl_enum::TEXTURE_WRAP_S, static_cast<int>( _wrap[0] ) );
-		gl.TextureParameteri( _id, gl_enum::TEXTURE_WRAP_T, static_cast<int>( _wrap[1] ) );
-		gl.TextureParameteri( _id, gl_enum::TEXTURE_WRAP_R, static_cast<int>( _wrap[2] ) );
-		gl.TextureParameteri( _id, gl_enum::TEXTURE_MIN_FILTER, static_cast<int>( _filter[0] ) );
-		gl.TextureParameteri( _id, gl_enum::TEXTURE_MAG_FILTER, static_cast<int>( _filter[1] ) );
-		gl.TextureParameterf( _id, gl_enum::TEXTURE_MAX_ANISOTROPY, 4.0f );
+	auto status = gl.ClientWaitSync( _sync, 0, 0 );
+	if ( status != gl_enum::ALREADY_SIGNALED && status != gl_enum::CONDITION_SATISFIED )
+		return false;
 
-		_bindlessHandle = gl.GetTextureHandleARB( _id );
-		gl.MakeTextureHandleResidentARB( _bindlessHandle );
+	gl.DeleteSync( _sync );
+	_sync = nullptr;
+	return true;
+}
 
-		_dirtySampler = false;
+//---------------------------------------------------------------------------------------------------------------------
+void fence::wait()
+{
+	while ( _sync )
+	{
+		auto status = gl.ClientWaitSync( _sync, +gl_enum::SYNC_FLUSH_COMMANDS_BIT, 1000000000ull );
+		if ( status == gl_enum::WAIT_FAILED )
+		{
+			log::error( "Waiting for fence failed" );
+			break;
+		}
+		else if ( status != gl_enum::TIMEOUT_EXPIRED )
+		{
+			gl.DeleteSync( _sync );
+			_sync = nullptr;
+		}
 	}
-
-	return _bindlessHandle;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -697,6 +2733,9 @@ void cmd_queue::gl_state::reset()
 	current_vb_layout = nullptr;
 	current_ib = nullptr;
 	dirty_input_assembly = true;
+	skip_draws = false;
+	pulled_layout = nullptr;
+	dirty_pulling_params = true;
 }
 
 //---------------------------------------------------------------------------------------------------------------------
@@ -723,6 +2762,204 @@ size_t cmd_queue::gl_state::write_temp_data( const void *data, size_t size )
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+//---------------------------------------------------------------------------------------------------------------------
+unsigned cmd_queue::gl_state::acquire_query()
+{
+	unsigned queryID = 0;
+	if ( !free_queries.empty() )
+	{
+		queryID = free_queries.back();
+		free_queries.pop_back();
+	}
+	else
+		gl.CreateQueries( gl_enum::TIMESTAMP, 1, &queryID );
+
+	return queryID;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+void cmd_queue::gl_state::resolve_zones()
+{
+	if ( !open_zones.empty() )
+	{
+		log::error( "%u GPU zone(s) still open at the end of frame", static_cast<unsigned>( open_zones.size() ) );
+
+		for ( auto index : open_zones )
+		{
+			auto &zone = zone_frames[zone_frame][index];
+			zone.end_query = acquire_query();
+			gl.QueryCounter( zone.end_query, gl_enum::TIMESTAMP );
+		}
+
+		open_zones.clear();
+	}
+
+	// Oldest frame in the ring, its queries should be done by now
+	zone_frame = ( zone_frame + 1 ) % gpu_zone_latency;
+	auto &frame = zone_frames[zone_frame];
+
+	bool available = !frame.empty();
+	for ( auto iter = frame.rbegin(); iter != frame.rend() && available; ++iter )
+	{
+		int result = 0;
+		gl.GetQueryObjectiv( iter->end_query, gl_enum::QUERY_RESULT_AVAILABLE, &result );
+		available = ( result != 0 );
+	}
+
+	// GPU is too far behind, drop the frame rather than stall, stale zones of older frame must not be reported
+	if ( !available )
+		resolved_zones.clear();
+	else
+	{
+		resolved_zones.resize( frame.size() );
+
+		uint64_t frameStart = 0;
+		for ( size_t i = 0; i < frame.size(); ++i )
+		{
+			uint64_t start = 0, end = 0;
+			gl.GetQueryObjectui64v( frame[i].start_query, gl_enum::QUERY_RESULT, &start );
+			gl.GetQueryObjectui64v( frame[i].end_query, gl_enum::QUERY_RESULT, &end );
+
+			if ( !i )
+				frameStart = start;
+
+			auto &zone = resolved_zones[i];
+			zone.name = std::move( frame[i].name );
+			zone.depth = frame[i].depth;
+			zone.start_ms = static_cast<double>( start - frameStart ) / 1000000.0;
+			zone.duration_ms = static_cast<double>( end - start ) / 1000000.0;
+		}
+	}
+
+	for ( auto &zone : frame )
+	{
+		free_queries.push_back( zone.start_query );
+		free_queries.push_back( zone.end_query );
+	}
+
+	frame.clear();
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+void cmd_queue::gl_state::release_queries()
+{
+	for ( auto &frame : zone_frames )
+	{
+		// Zones left open have no end query yet, zero is ignored
+		for ( auto &zone : frame )
+		{
+			gl.DeleteQueries( 1, &zone.start_query );
+			gl.DeleteQueries( 1, &zone.end_query );
+		}
+
+		frame.clear();
+	}
+
+	if ( !free_queries.empty() )
+		gl.DeleteQueries( static_cast<int>( free_queries.size() ), free_queries.data() );
+
+	free_queries.clear();
+	open_zones.clear();
+	resolved_zones.clear();
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+cmd_queue::gl_state::pixel_buffer cmd_queue::gl_state::acquire_pbo( size_t size )
+{
+	// Smallest free buffer which fits
+	size_t best = free_pbos.size();
+	for ( size_t i = 0; i < free_pbos.size(); ++i )
+	{
+		if ( free_pbos[i].capacity >= size && ( best == free_pbos.size() || free_pbos[i].capacity < free_pbos[best].capacity ) )
+			best = i;
+	}
+
+	pixel_buffer pbo;
+	if ( best < free_pbos.size() )
+	{
+		pbo = free_pbos[best];
+		free_pbos[best] = free_pbos.back();
+		free_pbos.pop_back();
+	}
+	else
+	{
+		pbo.capacity = align_up( size, size_t( 65536 ) );
+		gl.CreateBuffers( 1, &pbo.id );
+		gl.NamedBufferStorage( pbo.id, static_cast<int>( pbo.capacity ), nullptr, +gl_enum::MAP_READ_BIT );
+	}
+
+	return pbo;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+void cmd_queue::gl_state::resolve_readbacks()
+{
+	size_t done = 0;
+	for ( ; done < pending_readbacks.size(); ++done )
+	{
+		auto &pending = pending_readbacks[done];
+
+		// Fences signal in order, no need to poll the rest once one is not done
+		auto status = gl.ClientWaitSync( pending.fence, 0, 0 );
+		if ( status != gl_enum::ALREADY_SIGNALED && status != gl_enum::CONDITION_SATISFIED )
+		{
+			if ( status == gl_enum::WAIT_FAILED )
+				log::error( "Waiting for pixel readback fence failed" );
+
+			break;
+		}
+
+		gl.DeleteSync( pending.fence );
+
+		pending.result.data = static_cast<const uint8_t *>(
+		    gl.MapNamedBufferRange( pending.pbo.id, 0, static_cast<unsigned>( pending.result.size ), +gl_enum::MAP_READ_BIT ) );
+
+		if ( pending.result.data )
+		{
+			pending.callback( pending.result );
+			gl.UnmapNamedBuffer( pending.pbo.id );
+		}
+		else
+			log::error( "Could not map pixel pack buffer of finished readback" );
+
+		pending.pbo.unused_frames = 0;
+		free_pbos.push_back( pending.pbo );
+	}
+
+	if ( done )
+		pending_readbacks.erase( pending_readbacks.begin(), pending_readbacks.begin() + done );
+
+	// Pool grows to the peak number of readbacks in flight, shrink it back once the peak is over
+	for ( size_t i = 0; i < free_pbos.size(); )
+	{
+		if ( ++free_pbos[i].unused_frames > readback_max_unused_frames )
+		{
+			gl.DeleteBuffers( 1, &free_pbos[i].id );
+			free_pbos[i] = free_pbos.back();
+			free_pbos.pop_back();
+		}
+		else
+			++i;
+	}
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+void cmd_queue::gl_state::release_readbacks()
+{
+	// Callbacks of unfinished readbacks are never invoked
+	for ( auto &pending : pending_readbacks )
+	{
+		gl.DeleteSync( pending.fence );
+		gl.DeleteBuffers( 1, &pending.pbo.id );
+	}
+
+	for ( auto &pbo : free_pbos )
+		gl.DeleteBuffers( 1, &pbo.id );
+
+	pending_readbacks.clear();
+	free_pbos.clear();
+}
+
 //---------------------------------------------------------------------------------------------------------------------
 cmd_queue::cmd_queue( gl_state *state )
 	: _deferred( state == nullptr )
@@ -781,15 +3018,93 @@ void cmd_queue::clear_depth( float depth )
 void cmd_queue::update_texture( texture::ptr tex, const void *data, unsigned layer, unsigned mipLevel, size_t rowStride )
 {
 	assert( tex );
+	update_texture( tex, data, { 0, 0 }, { tex->width( mipLevel ), tex->height( mipLevel ) }, layer, mipLevel, rowStride );
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+void cmd_queue::update_texture( texture::ptr tex, const void *data, const uvec2 &offset, const uvec2 &size,
+                                unsigned layer, unsigned mipLevel, size_t rowStride )
+{
+	assert( tex && data );
+	assert( offset.x + size.x <= tex->width( mipLevel ) && offset.y + size.y <= tex->height( mipLevel ) );
+
+	auto internalF = detail::get_internal_format( tex->format() );
+
+	// Compressed formats have no pixel size, their rows are rows of 4x4 blocks
+	bool compressed = internalF.block_size != 0;
+	assert( !compressed || ( tex->type() == gl_enum::TEXTURE_2D && ( offset.x % 4 ) == 0 && ( offset.y % 4 ) == 0 ) );
+	assert( tex->type() != gl_enum::TEXTURE_1D || ( offset.y == 0 && size.y == 1 ) );
+
+	unsigned numRows = compressed ? ( size.y + 3 ) / 4 : size.y;
+	size_t rowSize = compressed ? ( ( size.x + 3 ) / 4 ) * internalF.block_size : size.x * internalF.pixel_size;
+
+	if ( !rowStride )
+		rowStride = rowSize;
+
+	assert( rowStride >= rowSize && ( compressed || ( rowStride % internalF.pixel_size ) == 0 ) );
 
 	if ( _deferred )
 	{
-		write( cmd_type::update_texture, layer, mipLevel, rowStride );
+		// Payload is stored tightly packed, so replay does not need the stride
+		write( cmd_type::update_texture, offset, size, layer, mipLevel );
+		write_data( data, rowSize, numRows, rowStride );
 		_resources.push_back( tex );
 	}
+	else if ( compressed )
+	{
+		tex->synchronize();
+
+		// Unpack parameters for compressed blocks are poorly supported, rows get packed here instead
+		std::vector<uint8_t> packed;
+		if ( rowStride != rowSize )
+		{
+			packed.resize( rowSize * numRows );
+			for ( unsigned i = 0; i < numRows; ++i )
+				memcpy( packed.data() + i * rowSize, static_cast<const uint8_t *>( data ) + i * rowStride, rowSize );
+
+			data = packed.data();
+		}
+
+		gl.CompressedTextureSubImage2D(
+		    tex->id(), mipLevel,
+		    offset.x, offset.y, size.x, size.y,
+		    tex->format(), static_cast<int>( detail::image_size( internalF, size.x, size.y ) ), data );
+	}
 	else
 	{
+		tex->synchronize();
+
+		if ( rowStride != rowSize )
+			glPixelStorei( GL_UNPACK_ROW_LENGTH, static_cast<int>( rowStride / internalF.pixel_size ) );
+
+		glPixelStorei( GL_UNPACK_ALIGNMENT, 1 );
+
+		if ( tex->type() == gl_enum::TEXTURE_1D )
+		{
+			gl.TextureSubImage1D(
+			    tex->id(), mipLevel,
+			    offset.x, size.x,
+			    internalF.components, internalF.type, data );
+		}
+		else if ( tex->type() == gl_enum::TEXTURE_2D )
+		{
+			gl.TextureSubImage2D(
+			    tex->id(), mipLevel,
+			    offset.x, offset.y, size.x, size.y,
+			    internalF.components, internalF.type, data );
+		}
+		else
+		{
+			gl.TextureSubImage3D(
+			    tex->id(), mipLevel,
+			    offset.x, offset.y, layer, size.x, size.y, 1,
+			    internalF.components, internalF.type, data );
+		}
 
+		glPixelStorei( GL_UNPACK_ALIGNMENT, 4 );
+
+		if ( rowStride != rowSize )
+			glPixelStorei( GL_UNPACK_ROW_LENGTH, 0 );
 	}
 }
 
@@ -852,15 +3167,40 @@ void cmd_queue::bind_shader( shader::ptr sh )
 	}
 	else
 	{
-		if ( sh )
+		auto program = sh;
+		if ( program && program->status() == shader_status::not_compiled )
+			program->compile_async();
+
+		// Hot reloaded program keeps its previous version bound until the recompiled one is ready
+		unsigned programID = 0;
+		if ( program )
+			programID = ( program->status() == shader_status::ready ) ? program->id() : program->previous_id();
+
+		// Program still compiling (or broken), use placeholder meanwhile or skip draws
+		if ( program && !programID )
 		{
-			if ( !sh->id() )
-				sh->compile();
+			program = shader_compiler::placeholder();
+			if ( program && program->status() == shader_status::not_compiled )
+				program->compile();
+
+			if ( program && program->status() == shader_status::ready )
+				programID = program->id();
+			else
+				program = nullptr;
+		}
 
-			gl.UseProgram( sh->id() );
+		_state->skip_draws = sh && !programID;
+		gl.UseProgram( programID );
+
+		// Uniforms are program state, parameters have to be uploaded again
+		auto pulledLayout = program ? program->pulled_layout() : nullptr;
+		if ( _state->pulled_layout != pulledLayout )
+		{
+			_state->pulled_layout = pulledLayout;
+			_state->dirty_input_assembly = true;
 		}
-		else
-			gl.UseProgram( 0 );
+
+		_state->dirty_pulling_params = true;
 	}
 }
 
@@ -929,19 +3269,24 @@ void cmd_queue::bind_index_buffer( buffer::ptr ib, bool use16bits, size_t offset
 }
 
 //---------------------------------------------------------------------------------------------------------------------
-void cmd_queue::bind_texture( texture::ptr tex, unsigned slot )
+void cmd_queue::bind_texture( texture::ptr tex, unsigned slot, sampler::ptr smp )
 {
 	if ( _deferred )
 	{
 		write( cmd_type::bind_texture, slot );
 		_resources.push_back( tex );
+		_resources.push_back( smp );
 	}
 	else
 	{
 		if ( tex )
-			tex->synchronize();
+		{
+			tex->synchronize( smp );
+			smp = tex->effective_sampler( smp );
+		}
 
 		gl.BindTextureUnit( slot, tex ? tex->id() : 0 );
+		gl.BindSampler( slot, smp ? smp->id() : 0 );
 	}
 }
 
@@ -976,6 +3321,27 @@ void cmd_queue::bind_storage_buffer( buffer::ptr buff, unsigned slot, size_t off
 	}
 }
 
+//---------------------------------------------------------------------------------------------------------------------
+void cmd_queue::bind_image( texture::ptr tex, unsigned slot, gl_enum access, unsigned mipLevel, int layer, gl_internal_format format )
+{
+	if ( _deferred )
+	{
+		write( cmd_type::bind_image, slot, access, mipLevel, layer, format );
+		_resources.push_back( tex );
+	}
+	else if ( tex )
+	{
+		if ( format == gl_internal_format::NONE )
+			format = tex->format();
+
+		assert( detail::is_image_format( format ) );
+		tex->synchronize();
+		gl.BindImageTexture( slot, tex->id(), static_cast<int>( mipLevel ), layer < 0, layer < 0 ? 0 : layer, access, format );
+	}
+	else
+		gl.BindImageTexture( slot, 0, 0, false, 0, gl_enum::READ_ONLY, gl_internal_format::RGBA8 );
+}
+
 //---------------------------------------------------------------------------------------------------------------------
 void cmd_queue::bind_render_targets( const render_target *colorTargets, size_t count, const render_target &depthStencilTarget, bool adjustViewport )
 {
@@ -1049,10 +3415,10 @@ void cmd_queue::set_uniform_block( const detail::location_variant &location, con
 		write_location_variant( location );
 		write_data( data, size );
 	}
-	else if ( auto id = find_uniform_id( location ); id >= 0 )
+	else if ( auto binding = find_uniform_block_binding( location ); binding >= 0 )
 	{
 		auto offset = _state->write_temp_data( data, size );
-		gl.BindBufferRange( gl_enum::UNIFORM_BUFFER, id, _state->temp_buffer->id(), offset, size );
+		gl.BindBufferRange( gl_enum::UNIFORM_BUFFER, binding, _state->temp_buffer->id(), offset, size );
 	}
 }
 
@@ -1153,17 +3519,17 @@ void cmd_queue::set_uniform( const detail::location_variant &location, const mat
 }
 
 //---------------------------------------------------------------------------------------------------------------------
-void cmd_queue::set_uniform( const detail::location_variant &location, texture::ptr tex )
+void cmd_queue::set_uniform( const detail::location_variant &location, texture::ptr tex, sampler::ptr smp )
 {
 	if ( _deferred )
 	{
-		write( cmd_type::set_uniform, gl_enum::TEXTURE );
+		write( cmd_type::set_uniform, gl_type::UNSIGNED_INT64 );
+		write_location_variant( location );
 		_resources.push_back( tex );
+		_resources.push_back( smp );
 	}
 	else if ( auto id = find_uniform_id( location ); id >= 0 )
-	{
-		assert( 0 ); // TODO
-	}
+		gl.UniformHandleui64ARB( id, tex ? tex->synchronize( smp ) : 0 );
 }
 
 //---------------------------------------------------------------------------------------------------------------------
@@ -1306,11 +3672,14 @@ void cmd_queue::draw( gl_enum primitive, size_t first, size_t count, size_t inst
 	{
 		write( cmd_type::draw, primitive, first, count, instanceCount, instanceBase );
 	}
-	else
+	else if ( !_state->skip_draws )
 	{
 		if ( _state->dirty_input_assembly )
 			synchronize_input_assembly();
 
+		if ( _state->pulled_layout )
+			synchronize_pulling_params( false );
+
 		gl.DrawArraysInstancedBaseInstance(
 		    primitive,
 		    static_cast<int>( first ),
@@ -1327,12 +3696,23 @@ void cmd_queue::draw_indexed( gl_enum primitive, size_t first, size_t count, siz
 	{
 		write( cmd_type::draw_indexed, primitive, first, count, instanceCount, instanceBase );
 	}
-	else
+	else if ( !_state->skip_draws )
 	{
 		if ( _state->dirty_input_assembly )
 			synchronize_input_assembly();
 
-		if ( _state->current_ib_16bits )
+		if ( _state->pulled_layout )
+		{
+			// Indices are fetched by the vertex shader too
+			synchronize_pulling_params( true );
+			gl.DrawArraysInstancedBaseInstance(
+			    primitive,
+			    static_cast<int>( first ),
+			    static_cast<unsigned>( count ),
+			    static_cast<unsigned>( instanceCount ),
+			    static_cast<unsigned>( instanceBase ) );
+		}
+		else if ( _state->current_ib_16bits )
 		{
 			gl.DrawElementsInstancedBaseInstance(
 			    primitive,
@@ -1355,6 +3735,203 @@ void cmd_queue::draw_indexed( gl_enum primitive, size_t first, size_t count, siz
 	}
 }
 
+//---------------------------------------------------------------------------------------------------------------------
+void cmd_queue::dispatch( unsigned groupsX, unsigned groupsY, unsigned groupsZ )
+{
+	if ( _deferred )
+	{
+		write( cmd_type::dispatch, groupsX, groupsY, groupsZ );
+	}
+	else if ( !_state->skip_draws )
+	{
+		gl.DispatchCompute( groupsX, groupsY, groupsZ );
+	}
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+void cmd_queue::dispatch_indirect( buffer::ptr args, size_t offset )
+{
+	assert( args );
+
+	if ( _deferred )
+	{
+		write( cmd_type::dispatch_indirect, offset );
+		_resources.push_back( args );
+	}
+	else if ( !_state->skip_draws )
+	{
+		args->synchronize();
+		assert( offset + 3 * sizeof( unsigned ) <= args->size() );
+
+		gl.BindBuffer( gl_enum::DISPATCH_INDIRECT_BUFFER, args->id() );
+		gl.DispatchComputeIndirect( static_cast<ptrdiff_t>( offset ) );
+		gl.BindBuffer( gl_enum::DISPATCH_INDIRECT_BUFFER, 0 );
+	}
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+void cmd_queue::memory_barrier( unsigned barriers )
+{
+	if ( _deferred )
+	{
+		write( cmd_type::memory_barrier, barriers );
+	}
+	else
+	{
+		gl.MemoryBarrier( barriers );
+	}
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+void cmd_queue::begin_zone( const char *name )
+{
+	assert( name );
+
+	if ( _deferred )
+	{
+		write( cmd_type::begin_zone );
+		write_data( name, strlen( name ) + 1 );
+	}
+	else
+	{
+		auto &frame = _state->zone_frames[_state->zone_frame];
+		auto &zone = frame.emplace_back();
+		zone.name = name;
+		zone.depth = static_cast<unsigned>( _state->open_zones.size() );
+		zone.start_query = _state->acquire_query();
+
+		gl.QueryCounter( zone.start_query, gl_enum::TIMESTAMP );
+		_state->open_zones.push_back( frame.size() - 1 );
+
+		// Debug groups are core since 4.3
+		gl.PushDebugGroup( gl_enum::DEBUG_SOURCE_APPLICATION, 0, -1, name );
+	}
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+void cmd_queue::end_zone()
+{
+	if ( _deferred )
+	{
+		write( cmd_type::end_zone );
+	}
+	else
+	{
+		assert( !_state->open_zones.empty() );
+		if ( _state->open_zones.empty() )
+			return;
+
+		auto &zone = _state->zone_frames[_state->zone_frame][_state->open_zones.back()];
+		_state->open_zones.pop_back();
+
+		zone.end_query = _state->acquire_query();
+		gl.QueryCounter( zone.end_query, gl_enum::TIMESTAMP );
+
+		gl.PopDebugGroup();
+	}
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+void cmd_queue::insert_fence( fence::ptr f )
+{
+	assert( f );
+
+	if ( _deferred )
+	{
+		write( cmd_type::insert_fence );
+		_resources.push_back( f );
+	}
+	else
+	{
+		if ( f->_sync )
+			gl.DeleteSync( f->_sync );
+
+		f->_sync = gl.FenceSync( gl_enum::SYNC_GPU_COMMANDS_COMPLETE, 0 );
+	}
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+void cmd_queue::read_pixels_async( const render_target &source, const uvec4 &rect, readback_callback callback, gl_format format, gl_type type )
+{
+	assert( callback && rect.z && rect.w );
+
+	if ( _deferred )
+	{
+		write( cmd_type::read_pixels_async, rect, format, type, source.layer, source.mip_level );
+		_resources.push_back( source.target );
+		_resources.push_back( std::make_shared<detail::readback_request>( std::move( callback ) ) );
+		return;
+	}
+
+	if ( format == gl_format::NONE )
+	{
+		if ( source.target )
+		{
+			auto internalF = detail::get_internal_format( source.target->format() );
+			format = internalF.components;
+			type = internalF.type;
+		}
+		else
+		{
+			format = gl_format::RGBA;
+			type = gl_type::UNSIGNED_BYTE;
+		}
+	}
+
+	else if ( type == gl_type::NONE )
+		type = gl_type::UNSIGNED_BYTE;
+
+	size_t size = static_cast<size_t>( rect.z ) * rect.w * detail::pixel_size( format, type );
+	auto pbo = _state->acquire_pbo( size );
+
+	gl.BindBuffer( gl_enum::PIXEL_PACK_BUFFER, pbo.id );
+	glPixelStorei( GL_PACK_ALIGNMENT, 1 );
+
+	if ( auto tex = source.target )
+	{
+		assert( rect.x + rect.z <= tex->width( source.mip_level ) && rect.y + rect.w <= tex->height( source.mip_level ) );
+
+		tex->synchronize();
+		gl.GetTextureSubImage(
+		    tex->id(), static_cast<int>( source.mip_level ),
+		    static_cast<int>( rect.x ), static_cast<int>( rect.y ), static_cast<int>( source.layer ), rect.z, rect.w, 1,
+		    format, type, static_cast<int>( size ), nullptr );
+	}
+	else
+	{
+		// Only draw framebuffer is ever rebound, read framebuffer stays the default one
+		glReadPixels( static_cast<int>( rect.x ), static_cast<int>( rect.y ), static_cast<int>( rect.z ), static_cast<int>( rect.w ),
+		              static_cast<unsigned>( format ), static_cast<unsigned>( type ), nullptr );
+	}
+
+	glPixelStorei( GL_PACK_ALIGNMENT, 4 );
+	gl.BindBuffer( gl_enum::PIXEL_PACK_BUFFER, 0 );
+
+	auto &pending = _state->pending_readbacks.emplace_back();
+	pending.pbo = pbo;
+	pending.fence = gl.FenceSync( gl_enum::SYNC_GPU_COMMANDS_COMPLETE, 0 );
+	pending.result.rect = rect;
+	pending.result.format = format;
+	pending.result.type = type;
+	pending.result.size = size;
+	pending.callback = std::move( callback );
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+std::future<std::vector<uint8_t>> cmd_queue::read_pixels_async( const render_target &source, const uvec4 &rect, gl_format format, gl_type type )
+{
+	// std::function needs copyable callable, promise is shared
+	auto promise = std::make_shared<std::promise<std::vector<uint8_t>>>();
+	auto result = promise->get_future();
+
+	read_pixels_async( source, rect, [promise]( const readback &rb )
+	{
+		promise->set_value( std::vector<uint8_t>( rb.data, rb.data + rb.size ) );
+	}, format, type );
+
+	return result;
+}
+
 //---------------------------------------------------------------------------------------------------------------------
 void cmd_queue::execute( ptr cmdQueue )
 {
@@ -1374,6 +3951,19 @@ void cmd_queue::execute( ptr cmdQueue )
 //---------------------------------------------------------------------------------------------------------------------
 bool cmd_queue::synchronize_input_assembly()
 {
+	if ( _state->pulled_layout )
+	{
+		assert( !_state->current_vb_layout || _state->current_vb_layout->stride == _state->pulled_layout->stride );
+
+		gl.BindVertexArray( detail::tl_currentContext->empty_vao() );
+		gl.BindBufferBase( gl_enum::SHADER_STORAGE_BUFFER, detail::vertex_pulling_vb_binding, _state->current_vb ? _state->current_vb->id() : 0 );
+		gl.BindBufferBase( gl_enum::SHADER_STORAGE_BUFFER, detail::vertex_pulling_ib_binding, _state->current_ib ? _state->current_ib->id() : 0 );
+
+		_state->dirty_input_assembly = false;
+		_state->dirty_pulling_params = true;
+		return true;
+	}
+
 	unsigned vaoID = _state->current_vb_layout
 	                 ? detail::tl_currentContext->get_or_create_layout_vao( _state->current_vb_layout )
 	                 : 0;
@@ -1406,9 +3996,34 @@ bool cmd_queue::synchronize_input_assembly()
 	return true;
 }
 
+//---------------------------------------------------------------------------------------------------------------------
+void cmd_queue::synchronize_pulling_params( bool indexed )
+{
+	// Storage buffers are read as uint words
+	assert( ( _state->current_vb_offset & 3 ) == 0 );
+	assert( !indexed || ( _state->current_ib_offset & ( _state->current_ib_16bits ? 1 : 3 ) ) == 0 );
+
+	unsigned params[4] =
+	{
+		static_cast<unsigned>( _state->current_vb_offset ),
+		static_cast<unsigned>( _state->current_ib_offset ),
+		indexed ? 1u : 0u,
+		_state->current_ib_16bits ? 1u : 0u
+	};
+
+	if ( _state->dirty_pulling_params || memcmp( params, _state->pulling_params, sizeof( params ) ) )
+	{
+		memcpy( _state->pulling_params, params, sizeof( params ) );
+		gl.Uniform4uiv( detail::vertex_pulling_params_location, 1, params );
+		_state->dirty_pulling_params = false;
+	}
+}
+
 //---------------------------------------------------------------------------------------------------------------------
 void cmd_queue::execute( gl_state *state )
 {
+	GL3D_PROFILE_ZONE( "cmd_queue::execute" );
+
 	_state = state;
 	_deferred = false;
 	_position = 0;
@@ -1439,6 +4054,13 @@ void cmd_queue::execute( gl_state *state )
 
 			case cmd_type::update_texture:
 			{
+				auto offset = read<uvec2>();
+				auto size = read<uvec2>();
+				auto layer = read<unsigned>();
+				auto mipLevel = read<unsigned>();
+				auto data = read_data();
+				auto tex = std::static_pointer_cast<texture>( _resources[resIndex++] );
+				update_texture( tex, data.first, offset, size, layer, mipLevel );
 			}
 			break;
 
@@ -1512,7 +4134,8 @@ void cmd_queue::execute( gl_state *state )
 			case cmd_type::bind_texture:
 			{
 				auto tex = std::static_pointer_cast<texture>( _resources[resIndex++] );
-				bind_texture( tex, read<unsigned>() );
+				auto smp = std::static_pointer_cast<sampler>( _resources[resIndex++] );
+				bind_texture( tex, read<unsigned>(), smp );
 			}
 			break;
 
@@ -1532,6 +4155,18 @@ void cmd_queue::execute( gl_state *state )
 			}
 			break;
 
+			case cmd_type::bind_image:
+			{
+				auto tex = std::static_pointer_cast<texture>( _resources[resIndex++] );
+				auto slot = read<unsigned>();
+				auto access = read<gl_enum>();
+				auto mipLevel = read<unsigned>();
+				auto layer = read<int>();
+				auto format = read<gl_internal_format>();
+				bind_image( tex, slot, access, mipLevel, layer, format );
+			}
+			break;
+
 			case cmd_type::set_uniform_block:
 			{
 				auto location = read_location_variant();
@@ -1564,6 +4199,14 @@ void cmd_queue::execute( gl_state *state )
 					case CASE_TYPE_MATRIX( gl_type::FLOAT_MAT3, mat3 );
 					case CASE_TYPE_MATRIX( gl_type::FLOAT_MAT4, mat4 );
 
+					case gl_type::UNSIGNED_INT64:
+					{
+						auto tex = std::static_pointer_cast<texture>( _resources[resIndex++] );
+						auto smp = std::static_pointer_cast<sampler>( _resources[resIndex++] );
+						set_uniform( read_location_variant(), tex, smp );
+					}
+					break;
+
 					default:
 						assert( 0 );
 						break;
@@ -1616,6 +4259,51 @@ void cmd_queue::execute( gl_state *state )
 			}
 			break;
 
+			case cmd_type::dispatch:
+			{
+				auto groupsX = read<unsigned>();
+				auto groupsY = read<unsigned>();
+				auto groupsZ = read<unsigned>();
+				dispatch( groupsX, groupsY, groupsZ );
+			}
+			break;
+
+			case cmd_type::dispatch_indirect:
+			{
+				auto args = std::static_pointer_cast<buffer>( _resources[resIndex++] );
+				dispatch_indirect( args, read<size_t>() );
+			}
+			break;
+
+			case cmd_type::memory_barrier:
+				memory_barrier( read<unsigned>() );
+				break;
+
+			case cmd_type::begin_zone:
+				begin_zone( static_cast<const char *>( read_data().first ) );
+				break;
+
+			case cmd_type::end_zone:
+				end_zone();
+				break;
+
+			case cmd_type::read_pixels_async:
+			{
+				auto rect = read<uvec4>();
+				auto format = read<gl_format>();
+				auto type = read<gl_type>();
+				auto layer = read<unsigned>();
+				auto mipLevel = read<unsigned>();
+				auto tex = std::static_pointer_cast<texture>( _resources[resIndex++] );
+				auto request = std::static_pointer_cast<detail::readback_request>( _resources[resIndex++] );
+				read_pixels_async( { tex, layer, mipLevel }, rect, request->callback, format, type );
+			}
+			break;
+
+			case cmd_type::insert_fence:
+				insert_fence( std::static_pointer_cast<fence>( _resources[resIndex++] ) );
+				break;
+
 			case cmd_type::execute:
 			{
 				auto cmdQueue = std::static_pointer_cast<cmd_queue>( _resources[resIndex++] );
@@ -1689,6 +4377,27 @@ context::context( ptr sharedContext )
 //---------------------------------------------------------------------------------------------------------------------
 context::~context()
 {
+	bool lastContext = texture_residency::release_slot( _residencySlot );
+
+	auto prevDC = wglGetCurrentDC();
+	auto prevContext = wglGetCurrentContext();
+
+	// Fails when the window is already gone, its objects are then deleted together with the context
+	if ( wglMakeCurrent( GetDC( HWND( _window_native_handle ) ), HGLRC( _native_handle ) ) )
+	{
+		release( lastContext );
+
+		if ( prevContext == HGLRC( _native_handle ) )
+			wglMakeCurrent( nullptr, nullptr );
+		else
+			wglMakeCurrent( prevDC, prevContext );
+	}
+	else if ( lastContext )
+		sampler::release_cache( false );
+
+	if ( tl_currentContext == this )
+		tl_currentContext = nullptr;
+
 	wglDeleteContext( HGLRC( _native_handle ) );
 }
 
@@ -1700,11 +4409,222 @@ void context::make_current( const uvec2 &defaultFBSize )
 
 	_defaultFramebufferSize = defaultFBSize;
 	tl_currentContext = this;
+
+	if ( !_extensionsQueried )
+		query_extensions();
+}
+#elif defined(__linux__)
+EGLDisplay g_eglDisplay = EGL_NO_DISPLAY;
+EGLConfig g_eglConfig = nullptr;
+
+//---------------------------------------------------------------------------------------------------------------------
+EGLDisplay egl_display()
+{
+	if ( g_eglDisplay != EGL_NO_DISPLAY )
+		return g_eglDisplay;
+
+	// Surfaceless platform needs neither X11 nor Wayland nor DRM device access, default display is the fallback
+	auto getPlatformDisplay = reinterpret_cast<PFNEGLGETPLATFORMDISPLAYEXTPROC>( eglGetProcAddress( "eglGetPlatformDisplayEXT" ) );
+	if ( getPlatformDisplay )
+		g_eglDisplay = getPlatformDisplay( EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr );
+
+	if ( g_eglDisplay == EGL_NO_DISPLAY )
+		g_eglDisplay = eglGetDisplay( EGL_DEFAULT_DISPLAY );
+
+	EGLint major = 0, minor = 0;
+	if ( !eglInitialize( g_eglDisplay, &major, &minor ) )
+	{
+		log::fatal( "Could not initialize EGL display: 0x%04x", eglGetError() );
+		g_eglDisplay = EGL_NO_DISPLAY;
+		return g_eglDisplay;
+	}
+
+	eglBindAPI( EGL_OPENGL_API );
+
+	EGLint configAttribs[] =
+	{
+		EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+		EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+		EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8, EGL_BLUE_SIZE, 8, EGL_ALPHA_SIZE, 8,
+		EGL_DEPTH_SIZE, 24, EGL_STENCIL_SIZE, 8,
+		EGL_NONE
+	};
+
+	EGLint numConfigs = 0;
+	if ( !eglChooseConfig( g_eglDisplay, configAttribs, &g_eglConfig, 1, &numConfigs ) || !numConfigs )
+		log::error( "No EGL config with pbuffer support" );
+
+	log::info( "EGL %d.%d: %s", major, minor, eglQueryString( g_eglDisplay, EGL_VENDOR ) );
+	return g_eglDisplay;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+void *create_pbuffer_surface( const uvec2 &size )
+{
+	if ( egl_display() == EGL_NO_DISPLAY || !g_eglConfig )
+		return EGL_NO_SURFACE;
+
+	EGLint attribs[] =
+	{
+		EGL_WIDTH, static_cast<EGLint>( size.x ? size.x : 1 ),
+		EGL_HEIGHT, static_cast<EGLint>( size.y ? size.y : 1 ),
+		EGL_NONE
+	};
+
+	auto surface = eglCreatePbufferSurface( egl_display(), g_eglConfig, attribs );
+	if ( surface == EGL_NO_SURFACE )
+		log::error( "Could not create pbuffer surface: 0x%04x", eglGetError() );
+
+	return surface;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+void destroy_pbuffer_surface( void *surface )
+{
+	if ( surface != EGL_NO_SURFACE )
+		eglDestroySurface( egl_display(), surface );
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+context::context( void *windowNativeHandle, ptr sharedContext )
+	: cmd_queue( &_glState )
+	, _window_native_handle( windowNativeHandle )
+{
+	auto display = egl_display();
+
+	// Mesa llvmpipe may expose only 4.5, which covers everything the library needs
+	for ( EGLint minor : { 6, 5 } )
+	{
+		EGLint attribs[] =
+		{
+			EGL_CONTEXT_MAJOR_VERSION, 4,
+			EGL_CONTEXT_MINOR_VERSION, minor,
+			EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+			EGL_NONE
+		};
+
+		_native_handle = eglCreateContext(
+		                     display, g_eglConfig ? g_eglConfig : EGL_NO_CONFIG_KHR,
+		                     sharedContext ? EGLContext( sharedContext->_native_handle ) : EGL_NO_CONTEXT,
+		                     attribs );
+
+		if ( _native_handle != EGL_NO_CONTEXT )
+		{
+			if ( minor < 6 )
+				g_shaderPrologue = s_shaderPrologue450;
+
+			break;
+		}
+	}
+
+	if ( _native_handle == EGL_NO_CONTEXT )
+	{
+		log::fatal( "Could not create OpenGL 4.5+ core context: 0x%04x", eglGetError() );
+		return;
+	}
+
+	eglMakeCurrent( display, _window_native_handle, _window_native_handle, _native_handle );
+	gl = gl_api();
+	reset();
+	eglMakeCurrent( display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT );
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+context::context( ptr sharedContext )
+	: context( nullptr, sharedContext )
+{
+
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+context::~context()
+{
+	bool lastContext = texture_residency::release_slot( _residencySlot );
+
+	if ( _native_handle != EGL_NO_CONTEXT )
+	{
+		auto prevContext = eglGetCurrentContext();
+		auto prevDraw = eglGetCurrentSurface( EGL_DRAW );
+		auto prevRead = eglGetCurrentSurface( EGL_READ );
+
+		if ( eglMakeCurrent( g_eglDisplay, _window_native_handle, _window_native_handle, _native_handle ) )
+			release( lastContext );
+		else if ( lastContext )
+			sampler::release_cache( false );
+
+		if ( prevContext == EGLContext( _native_handle ) || prevContext == EGL_NO_CONTEXT )
+			eglMakeCurrent( g_eglDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT );
+		else
+			eglMakeCurrent( g_eglDisplay, prevDraw, prevRead, prevContext );
+
+		eglDestroyContext( g_eglDisplay, _native_handle );
+	}
+
+	if ( tl_currentContext == this )
+		tl_currentContext = nullptr;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+void context::make_current( const uvec2 &defaultFBSize )
+{
+	// Pbuffer surface is the default framebuffer, contexts without one run surfaceless
+	if ( eglGetCurrentContext() != EGLContext( _native_handle ) || eglGetCurrentSurface( EGL_DRAW ) != _window_native_handle )
+		eglMakeCurrent( g_eglDisplay, _window_native_handle, _window_native_handle, _native_handle );
+
+	_defaultFramebufferSize = defaultFBSize;
+	tl_currentContext = this;
+
+	if ( !_extensionsQueried )
+		query_extensions();
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+void context::window_native_handle( void *surface )
+{
+	if ( tl_currentContext == this )
+		eglMakeCurrent( g_eglDisplay, surface, surface, _native_handle );
+
+	_window_native_handle = surface;
 }
 #else
 #error Not implemented!
 #endif
 
+//---------------------------------------------------------------------------------------------------------------------
+void context::release( bool lastContext )
+{
+	_glState.release_readbacks();
+	_glState.release_queries();
+
+	if ( lastContext )
+		sampler::release_cache( true );
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+bool context::has_extension( std::string_view name ) const
+{
+	return std::binary_search( _extensions.begin(), _extensions.end(), name );
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+void context::query_extensions()
+{
+	int count = 0;
+	gl.GetIntegerv( gl_enum::NUM_EXTENSIONS, &count );
+
+	_extensions.clear();
+	for ( int i = 0; i < count; ++i )
+	{
+		if ( auto name = gl.GetStringi( gl_enum::EXTENSIONS, static_cast<unsigned>( i ) ) )
+			_extensions.emplace_back( name );
+	}
+
+	std::sort( _extensions.begin(), _extensions.end() );
+	_extensionsQueried = true;
+
+	_parallelShaderCompile = has_extension( "GL_KHR_parallel_shader_compile" );
+}
+
 //---------------------------------------------------------------------------------------------------------------------
 unsigned context::get_or_create_layout_vao( const detail::layout *layout )
 {
@@ -1745,6 +4665,15 @@ unsigned context::get_or_create_layout_vao( const detail::layout *layout )
 	return vaoID;
 }
 
+//---------------------------------------------------------------------------------------------------------------------
+unsigned context::empty_vao()
+{
+	if ( !_emptyVAO )
+		gl.CreateVertexArrays( 1, &_emptyVAO );
+
+	return _emptyVAO;
+}
+
 //---------------------------------------------------------------------------------------------------------------------
 unsigned context::get_or_create_fbo( const render_target *colorTargets, size_t count, const render_target &depthStencilTarget )
 {
@@ -1752,29 +4681,16 @@ unsigned context::get_or_create_fbo( const render_target *colorTargets, size_t c
 	if ( ( !colorTargets || !count ) && !depthStencilTarget.target )
 		return 0;
 
-	for ( auto &desc : _fboDescs )
+	fbo_signature signature( colorTargets, count, depthStencilTarget );
+	if ( auto index = find_fbo( signature ); index != UINT_MAX )
 	{
-		if ( desc.num_color_targets != count || desc.depth_stencil_target != depthStencilTarget )
-			continue;
-
-		bool found = true;
-		for ( size_t i = 0; i < count; ++i )
-		{
-			if ( desc.color_targets[i] != colorTargets[i] )
-			{
-				found = false;
-				break;
-			}
-		}
-
-		if ( !found )
-			continue;
-
+		auto &desc = _fboDescs[index];
 		desc.unused_frames = 0;
 		return desc.fbo_id;
 	}
 
 	auto &desc = _fboDescs.emplace_back();
+	desc.signature = signature;
 	gl.CreateFramebuffers( 1, &desc.fbo_id );
 
 	for ( size_t i = 0; i < count; ++i )
@@ -1819,13 +4735,174 @@ unsigned context::get_or_create_fbo( const render_target *colorTargets, size_t c
 
 	if ( gl.CheckNamedFramebufferStatus( desc.fbo_id, gl_enum::FRAMEBUFFER ) != gl_enum::FRAMEBUFFER_COMPLETE )
 	{
+		gl.DeleteFramebuffers( 1, &desc.fbo_id );
 		_fboDescs.pop_back();
 		return 0;
 	}
 
+	insert_fbo( static_cast<unsigned>( _fboDescs.size() - 1 ) );
 	return desc.fbo_id;
 }
 
+//---------------------------------------------------------------------------------------------------------------------
+context::fbo_signature::fbo_signature( const render_target *colorTargets, size_t count, const render_target &depthStencilTarget )
+	: num_color_targets( static_cast<unsigned>( count ) )
+{
+	assert( count <= max_render_targets );
+
+	// FNV-1a over raw texture pointers, layers & mip levels
+	uint64_t result = 14695981039346656037ull;
+	auto combine = [&]( uint64_t value )
+	{
+		result ^= value;
+		result *= 1099511628211ull;
+	};
+
+	combine( count );
+	for ( size_t i = 0; i <= count; ++i )
+	{
+		auto &rt = ( i < count ) ? colorTargets[i] : depthStencilTarget;
+		auto slot = ( i < count ) ? i : max_render_targets;
+
+		targets[slot] = rt.target.get();
+		layers[slot] = rt.layer;
+		mip_levels[slot] = rt.mip_level;
+
+		combine( reinterpret_cast<std::uintptr_t>( targets[slot] ) );
+		combine( ( uint64_t( rt.layer ) << 32 ) | rt.mip_level );
+	}
+
+	hash = static_cast<size_t>( result );
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+bool context::fbo_signature::operator==( const fbo_signature &rhs ) const
+{
+	if ( hash != rhs.hash || num_color_targets != rhs.num_color_targets )
+		return false;
+
+	for ( unsigned i = 0; i <= max_render_targets; ++i )
+		if ( targets[i] != rhs.targets[i] || layers[i] != rhs.layers[i] || mip_levels[i] != rhs.mip_levels[i] )
+			return false;
+
+	return true;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+unsigned context::find_fbo( const fbo_signature &signature ) const
+{
+	if ( _fboTable.empty() )
+		return UINT_MAX;
+
+	auto mask = _fboTable.size() - 1;
+	for ( auto slot = signature.hash & mask; ; slot = ( slot + 1 ) & mask )
+	{
+		auto index = _fboTable[slot];
+		if ( index == UINT_MAX || _fboDescs[index].signature == signature )
+			return index;
+	}
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+void context::insert_fbo( unsigned index )
+{
+	// Keep load factor at most 1/2, so probing sequences stay short
+	if ( ( _fboDescs.size() * 2 ) > _fboTable.size() )
+	{
+		rebuild_fbo_table( maximum( size_t( 16 ), _fboTable.size() * 2 ) );
+		return;
+	}
+
+	auto mask = _fboTable.size() - 1;
+	auto slot = _fboDescs[index].signature.hash & mask;
+	while ( _fboTable[slot] != UINT_MAX )
+		slot = ( slot + 1 ) & mask;
+
+	_fboTable[slot] = index;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+void context::rebuild_fbo_table( size_t capacity )
+{
+	assert( ( capacity & ( capacity - 1 ) ) == 0 );
+
+	_fboTable.assign( capacity, UINT_MAX );
+
+	auto mask = capacity - 1;
+	for ( unsigned i = 0; i < _fboDescs.size(); ++i )
+	{
+		auto slot = _fboDescs[i].signature.hash & mask;
+		while ( _fboTable[slot] != UINT_MAX )
+			slot = ( slot + 1 ) & mask;
+
+		_fboTable[slot] = i;
+	}
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+void context::next_frame()
+{
+	bool evicted = false;
+	size_t numFBOs = _fboDescs.size();
+
+	for ( auto iter = _layoutVAOs.begin(); iter != _layoutVAOs.end(); )
+	{
+		if ( ++iter->second.unused_frames > _maxUnusedFrames )
+		{
+			gl.DeleteVertexArrays( 1, &iter->second.vao_id );
+			iter = _layoutVAOs.erase( iter );
+			++_evictedVAOs;
+			evicted = true;
+		}
+		else
+			++iter;
+	}
+
+	for ( size_t i = 0; i < _fboDescs.size(); )
+	{
+		auto &desc = _fboDescs[i];
+
+		// FBO holds the last reference to some attachment, nobody can ask for it again
+		bool orphaned = desc.depth_stencil_target.target && desc.depth_stencil_target.target.use_count() == 1;
+		for ( unsigned j = 0; j < desc.num_color_targets && !orphaned; ++j )
+			orphaned = desc.color_targets[j].target && desc.color_targets[j].target.use_count() == 1;
+
+		if ( ++desc.unused_frames > _maxUnusedFrames || orphaned )
+		{
+			gl.DeleteFramebuffers( 1, &desc.fbo_id );
+			desc = std::move( _fboDescs.back() );
+			_fboDescs.pop_back();
+			++_evictedFBOs;
+		}
+		else
+			++i;
+	}
+
+	// Deleted VAO may still be bound
+	if ( evicted )
+		_glState.dirty_input_assembly = true;
+
+	// Removed entries moved others around, indices in the table are stale
+	if ( _fboDescs.size() != numFBOs )
+		rebuild_fbo_table( _fboTable.size() );
+
+	_glState.resolve_zones();
+	_glState.resolve_readbacks();
+
+	texture_residency::flush_retired( _residencySlot );
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+context::cache_stats context::stats() const
+{
+	cache_stats result;
+	result.vaos = _layoutVAOs.size();
+	result.fbos = _fboDescs.size();
+	result.evicted_vaos = _evictedVAOs;
+	result.evicted_fbos = _evictedFBOs;
+	return result;
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 //---------------------------------------------------------------------------------------------------------------------
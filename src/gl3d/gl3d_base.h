@@ -4,6 +4,7 @@
 #include <limits.h>
 
 #include <array>
+#include <atomic>
 #include <functional>
 #include <mutex>
 #include <type_traits>
@@ -14,15 +15,26 @@
 #define GL3D_ENUM_PLUS(_Type) \
 	constexpr auto operator+( _Type t ) { return static_cast<std::underlying_type_t<_Type>>( t ); }
 
+#define GL3D_CONCAT_IMPL(_A, _B) _A##_B
+#define GL3D_CONCAT(_A, _B) GL3D_CONCAT_IMPL(_A, _B)
+
+/// Scoped CPU profiler zone, name is not copied and has to outlive the profiler (string literal)
+#define GL3D_PROFILE_ZONE(_Name) gl3d::detail::profiler_zone GL3D_CONCAT(_profilerZone, __LINE__) { _Name }
+
 #if defined(GL3D_DYNAMIC)
 	#if defined(_MSC_VER)
 		// TODO: Find a better way?
 		#pragma warning(disable: 4251)
 	#endif
-	#if defined(GL3D_BUILDING)
-		#define GL3D_API __declspec(dllexport)
+	#if defined(_WIN32)
+		#if defined(GL3D_BUILDING)
+			#define GL3D_API __declspec(dllexport)
+		#else
+			#define GL3D_API __declspec(dllimport)
+		#endif
 	#else
-		#define GL3D_API __declspec(dllimport)
+		// Shared object built with -fvisibility=hidden exports only the API
+		#define GL3D_API __attribute__((visibility("default")))
 	#endif
 #else
 	#define GL3D_API
@@ -34,6 +46,7 @@ namespace gl3d {
 class buffer;
 class cmd_queue;
 class context;
+class sampler;
 class shader;
 class shader_code;
 class texture;
@@ -58,9 +71,7 @@ using files_t = std::vector<std::filesystem::path>;
 //---------------------------------------------------------------------------------------------------------------------
 GL3D_API std::string_view trim( std::string_view text );
 GL3D_API std::string_view to_string_view( bytes_t &bytes );
-GL3D_API void for_each_line( std::string_view text, std::function<void( std::string_view, unsigned )> callback );
 GL3D_API void read_all_bytes( std::istream &is, bytes_t &bytes, bool addNullTerm = false, size_t size = size_t( -1 ) );
-GL3D_API bool unroll_includes( std::stringstream &ss, std::string_view sourceCode, const std::filesystem::path &cwd );
 GL3D_API void *get_proc_address( const char *name );
 
 //---------------------------------------------------------------------------------------------------------------------
@@ -136,7 +147,7 @@ public:
 
 	bool operator-=( unsigned id ) { return remove( id ); }
 
-	template <typename... Args> std::result_of_t<function_t( Args... )> operator()( Args &&... args ) const
+	template <typename... Args> std::result_of_t<function_t( Args &... )> operator()( Args &&... args ) const
 	{
 		thread_local decltype( _callbacks ) callbacksCopy;
 
@@ -147,7 +158,7 @@ public:
 		}
 		size_t lastIndex = callbacksCopy.size();
 
-		if constexpr ( std::is_void_v<std::result_of_t<function_t( Args... )>> )
+		if constexpr ( std::is_void_v<std::result_of_t<function_t( Args &... )>> )
 		{
 			for ( size_t i = firstIndex; i < lastIndex; ++i )
 				callbacksCopy[i].callback( args... );
@@ -210,10 +221,13 @@ template <typename F> struct proc_wrapper
 	void *ptr = nullptr;
 	proc_wrapper( const char *name ) : ptr( get_proc_address( name ) ) { }
 
+	/// @brief Whether the function pointer was returned, on EGL true even for unsupported functions
+	explicit operator bool() const { return ptr != nullptr; }
+
 	template <typename... Args>
 	std::result_of_t<std::function<F>( Args... )> operator()( Args... args ) const
 	{
-		auto f = static_cast<F *>( ptr );
+		auto f = reinterpret_cast<F *>( ptr );
 		if constexpr ( std::is_void_v<std::result_of_t<std::function<F>( Args... )>> )
 			f( args... );
 		else
@@ -285,11 +299,101 @@ GL3D_API extern detail::callback_chain<void( const log::message & )> on_log_mess
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+namespace detail { GL3D_API extern std::atomic<bool> g_profilerEnabled; }
+
+struct GL3D_API profiler
+{
+	struct event
+	{
+		const char *name = nullptr;
+		uint64_t start_ns = 0; // Since application start
+		uint64_t end_ns = 0;
+		unsigned thread_id = 0; // Sequential number of recording thread
+		unsigned depth = 0;
+	};
+
+	/// @brief Starts or stops recording, disabled zones cost a single branch
+	static void enable( bool enabled );
+	static bool enabled() { return detail::g_profilerEnabled.load( std::memory_order_relaxed ); }
+
+	/// @brief Moves events recorded by all threads into history, called once per frame by the main loop
+	static void flush();
+
+	/// @brief Flushed events, oldest first, history keeps at most max_events
+	static std::vector<event> events();
+	static void clear();
+
+	/// @brief Writes flushed events as Chrome trace event JSON (chrome://tracing, Perfetto)
+	static bool export_chrome_trace( const std::filesystem::path &path );
+
+	static constexpr size_t max_events = 1u << 20;
+};
+
+namespace detail {
+
+//---------------------------------------------------------------------------------------------------------------------
+class GL3D_API profiler_zone
+{
+public:
+	profiler_zone( const char *name ) { if ( g_profilerEnabled.load( std::memory_order_relaxed ) ) begin( name ); }
+	~profiler_zone() { if ( _name ) end(); }
+
+	profiler_zone( const profiler_zone & ) = delete;
+	profiler_zone &operator=( const profiler_zone & ) = delete;
+
+private:
+	void begin( const char *name );
+	void end();
+
+	const char *_name = nullptr;
+	uint64_t _start = 0;
+};
+
+} // namespace gl3d::detail
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace detail {
+
+//---------------------------------------------------------------------------------------------------------------------
+class GL3D_API mapped_file
+{
+public:
+	using ptr = std::shared_ptr<mapped_file>;
+
+	/// @brief Maps whole file into memory as read only
+	mapped_file( const std::filesystem::path &path );
+
+	/// @brief Takes ownership of already loaded bytes, used when file has no backing storage on disk
+	mapped_file( bytes_t &&bytes );
+
+	virtual ~mapped_file();
+
+	const uint8_t *data() const { return _data; }
+	size_t size() const { return _size; }
+
+	bool valid() const { return _data != nullptr; }
+
+protected:
+	const uint8_t *_data = nullptr;
+	size_t _size = 0;
+
+	bytes_t _bytes;
+	void *_fileHandle = nullptr;
+	void *_mappingHandle = nullptr;
+};
+
+}
+
+//---------------------------------------------------------------------------------------------------------------------
 struct GL3D_API vfs
 {
 	static void mount( const std::filesystem::path &path );
 	static bool unmount( const std::filesystem::path &path );
 	static bool load( const std::filesystem::path &path, detail::bytes_t &bytes );
+
+	/// @brief Maps file from mounted folder into memory, falls back to vfs::load for other sources
+	static detail::mapped_file::ptr map( const std::filesystem::path &path );
 };
 
 GL3D_API extern detail::callback_chain<bool( const std::filesystem::path &, detail::bytes_t & ), true> on_vfs_load;
@@ -8,6 +8,7 @@
 #include <fstream>
 #include <sstream>
 #include <chrono>
+#include <deque>
 
 #if defined(WIN32)
 	#ifndef VC_EXTRALEAN
@@ -18,6 +19,13 @@
 		#define WIN32_LEAN_AND_MEAN
 	#endif
 	#include <windows.h>
+#elif defined(__linux__)
+	#include <EGL/egl.h>
+	#include <fcntl.h>
+	#include <strings.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <unistd.h>
 #else
 	#error Not implemented!
 #endif
@@ -44,7 +52,6 @@ decltype( on_vfs_load ) on_vfs_load;
 
 namespace detail {
 
-constexpr char *s_lineSeparator = "\n";
 constexpr size_t logBufferSize = 1025;
 thread_local char tl_logBuffer[logBufferSize];
 
@@ -66,22 +73,6 @@ std::string_view to_string_view( bytes_t &bytes )
 	return std::string_view( reinterpret_cast<const char *>( bytes.data() ), bytes.size() );
 }
 
-//---------------------------------------------------------------------------------------------------------------------
-void for_each_line( std::string_view text, std::function<void( std::string_view, unsigned )> callback )
-{
-	size_t cursor = 0;
-	unsigned lineNum = 0;
-	while ( cursor <= text.length() )
-	{
-		auto sepPos = text.find( s_lineSeparator, cursor );
-		if ( sepPos == std::string::npos )
-			sepPos = text.length();
-
-		callback( text.substr( cursor, sepPos - cursor ), ++lineNum );
-		cursor = sepPos + strlen( s_lineSeparator );
-	}
-}
-
 //---------------------------------------------------------------------------------------------------------------------
 void read_all_bytes( std::istream &is, bytes_t &bytes, bool addNullTerm, size_t size )
 {
@@ -97,67 +88,18 @@ void read_all_bytes( std::istream &is, bytes_t &bytes, bool addNullTerm, size_t
 	if ( addNullTerm ) bytes.push_back( 0 );
 }
 
-//---------------------------------------------------------------------------------------------------------------------
-bool unroll_includes( std::stringstream &ss, std::string_view sourceCode, const std::filesystem::path &cwd )
-{
-	bool result = true;
-
-	for_each_line( sourceCode, [&]( std::string_view line, unsigned lineNum )
-	{
-		if ( !result ) return;
-
-		bool addLine = true;
-
-		if ( auto dir = trim( line ); !dir.empty() && dir[0] == '#' )
-		{
-			dir = trim( line.substr( 1 ) ); // Cut away '#' & trim
-			if ( starts_with_nocase( dir, "include" ) )
-			{
-				addLine = false;
-				dir = trim( dir.substr( 7 ) ); // Cut away "include" & trim
-
-				bool isRelative = false;
-
-				if ( dir[0] == '"' && dir.back() == '"' )
-					isRelative = true;
-				else if ( dir[0] == '<' && dir.back() == '>' )
-					isRelative = false;
-				else
-				{
-					log::error( "Invalid include directive at line %d", lineNum );
-					result = false;
-					return;
-				}
-
-				std::filesystem::path path = trim( dir.substr( 1, dir.length() - 2 ) );
-				if ( isRelative )
-					path = cwd / path;
-
-				bytes_t bytes;
-				if ( !vfs::load( path, bytes ) )
-				{
-					log::error( "Could not open file stream: %s", path.c_str() );
-					result = false;
-					return;
-				}
-
-				if ( !unroll_includes( ss, detail::to_string_view( bytes ), path.parent_path() ) )
-					return;
-			}
-		}
-
-		if ( addLine )
-			ss << line << std::endl;
-	} );
-
-	return result;
-}
-
 //---------------------------------------------------------------------------------------------------------------------
 void *get_proc_address( const char *name )
 {
 #if defined(WIN32)
-	return wglGetProcAddress( name );
+	// Some drivers return small values instead of null for unsupported functions
+	auto result = wglGetProcAddress( name );
+	auto value = reinterpret_cast<std::intptr_t>( result );
+	return ( value >= -1 && value <= 3 ) ? nullptr : result;
+#elif defined(__linux__)
+	// Core functions are returned as well, EGL_KHR_get_all_proc_addresses is part of EGL 1.5. Result is never null,
+	// not even for names unknown to the driver, support has to be checked with context::has_extension().
+	return reinterpret_cast<void *>( eglGetProcAddress( name ) );
 #else
 #error Not implemented!
 #endif
@@ -253,6 +195,30 @@ void gamepad_state::release_port( unsigned port )
 		gamepad[port].port = UINT_MAX;
 }
 
+//---------------------------------------------------------------------------------------------------------------------
+bool resolve_mounted_path( const std::filesystem::path &mountPath, const std::filesystem::path &relPath, std::filesystem::path &result )
+{
+	auto mountPathStr = mountPath.string();
+
+	result = std::filesystem::absolute( mountPath / relPath );
+	result.make_preferred();
+	auto resultStr = result.string();
+
+	// Do not allow escaping mounted folder
+	if ( resultStr.length() <= mountPathStr.length() )
+		return false;
+
+#if defined(WIN32)
+	if ( _memicmp( mountPathStr.c_str(), resultStr.c_str(), mountPathStr.length() ) )
+		return false;
+#else
+	if ( strncasecmp( mountPathStr.c_str(), resultStr.c_str(), mountPathStr.length() ) )
+		return false;
+#endif
+
+	return std::filesystem::is_regular_file( result );
+}
+
 //---------------------------------------------------------------------------------------------------------------------
 struct mount_info
 {
@@ -294,6 +260,10 @@ struct log_init
 			SetConsoleTextAttribute( GetStdHandle( STD_OUTPUT_HANDLE ), color );
 			printf( "%s\n", msg.text );
 			SetConsoleTextAttribute( GetStdHandle( STD_OUTPUT_HANDLE ), 7 );
+#elif defined(__linux__)
+			static const char *s_typeColors[] = { "\033[37m", "\033[92m", "\033[93m", "\033[91m", "\033[93;41m" };
+			const char *color = s_typeColors[static_cast<size_t>( msg.type )];
+			printf( "\033[90m[%02d:%02d.%03d] %s%s\033[0m\n", minutes, seconds, milis, color, msg.text );
 #else
 #error Not implemented!
 #endif
@@ -355,19 +325,10 @@ void vfs::mount( const std::filesystem::path &path )
 	auto iter = std::find( detail::g_mountInfos.begin(), detail::g_mountInfos.end(), absPath );
 	if ( iter == detail::g_mountInfos.end() )
 	{
-		auto callback = [absPath, absPathStr]( const std::filesystem::path & relPath, detail::bytes_t &bytes )->bool
+		auto callback = [absPath]( const std::filesystem::path & relPath, detail::bytes_t &bytes )->bool
 		{
-			auto finalPath = std::filesystem::absolute( absPath / relPath );
-			finalPath.make_preferred();
-			auto finalPathStr = finalPath.string();
-
-			if ( finalPathStr.length() <= absPathStr.length() )
-				return false;
-
-			if ( _memicmp( absPathStr.c_str(), finalPathStr.c_str(), absPathStr.length() ) )
-				return false;
-
-			if ( std::filesystem::is_regular_file( finalPath ) )
+			std::filesystem::path finalPath;
+			if ( detail::resolve_mounted_path( absPath, relPath, finalPath ) )
 			{
 				std::ifstream ifs( finalPath.c_str(), std::ios_base::in | std::ios_base::binary );
 				if ( !ifs.is_open() )
@@ -407,9 +368,285 @@ bool vfs::unmount( const std::filesystem::path &path )
 //---------------------------------------------------------------------------------------------------------------------
 bool vfs::load( const std::filesystem::path &path, detail::bytes_t &bytes )
 {
+	GL3D_PROFILE_ZONE( "vfs::load" );
 	return on_vfs_load( path, bytes );
 }
 
+//---------------------------------------------------------------------------------------------------------------------
+detail::mapped_file::ptr vfs::map( const std::filesystem::path &path )
+{
+	{
+		std::scoped_lock lock( detail::g_mountInfosMutex );
+
+		// Latest mounted folders take precedence, same as in on_vfs_load
+		for ( auto iter = detail::g_mountInfos.rbegin(); iter != detail::g_mountInfos.rend(); ++iter )
+		{
+			std::filesystem::path finalPath;
+			if ( !detail::resolve_mounted_path( iter->path, path, finalPath ) )
+				continue;
+
+			auto result = std::make_shared<detail::mapped_file>( finalPath );
+			if ( result->valid() )
+				return result;
+		}
+	}
+
+	detail::bytes_t bytes;
+	if ( !load( path, bytes ) )
+		return nullptr;
+
+	return std::make_shared<detail::mapped_file>( std::move( bytes ) );
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace detail {
+
+//---------------------------------------------------------------------------------------------------------------------
+mapped_file::mapped_file( const std::filesystem::path &path )
+{
+#if defined(WIN32)
+	_fileHandle = CreateFileW(
+	                  path.wstring().c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+	                  OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr );
+
+	if ( _fileHandle == INVALID_HANDLE_VALUE )
+	{
+		_fileHandle = nullptr;
+		log::error( "Could not open file: %s", path.string().c_str() );
+		return;
+	}
+
+	LARGE_INTEGER fileSize;
+	if ( !GetFileSizeEx( _fileHandle, &fileSize ) || !fileSize.QuadPart )
+		return;
+
+	_mappingHandle = CreateFileMappingW( _fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr );
+	if ( !_mappingHandle )
+	{
+		log::error( "Could not map file: %s", path.string().c_str() );
+		return;
+	}
+
+	_data = static_cast<const uint8_t *>( MapViewOfFile( _mappingHandle, FILE_MAP_READ, 0, 0, 0 ) );
+	_size = _data ? static_cast<size_t>( fileSize.QuadPart ) : 0;
+#elif defined(__linux__)
+	int fd = open( path.c_str(), O_RDONLY );
+	if ( fd < 0 )
+	{
+		log::error( "Could not open file: %s", path.string().c_str() );
+		return;
+	}
+
+	// Mapping stays valid after the descriptor is closed
+	struct stat st;
+	if ( !fstat( fd, &st ) && st.st_size )
+	{
+		auto data = mmap( nullptr, static_cast<size_t>( st.st_size ), PROT_READ, MAP_PRIVATE, fd, 0 );
+		if ( data != MAP_FAILED )
+		{
+			_data = static_cast<const uint8_t *>( data );
+			_size = static_cast<size_t>( st.st_size );
+			_mappingHandle = data;
+		}
+		else
+			log::error( "Could not map file: %s", path.string().c_str() );
+	}
+
+	close( fd );
+#else
+#error Not implemented!
+#endif
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+mapped_file::mapped_file( bytes_t &&bytes )
+	: _bytes( std::move( bytes ) )
+{
+	_data = _bytes.data();
+	_size = _bytes.size();
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+mapped_file::~mapped_file()
+{
+#if defined(WIN32)
+	if ( _mappingHandle )
+	{
+		if ( _data )
+			UnmapViewOfFile( _data );
+
+		CloseHandle( _mappingHandle );
+	}
+
+	if ( _fileHandle )
+		CloseHandle( _fileHandle );
+#elif defined(__linux__)
+	if ( _mappingHandle )
+		munmap( _mappingHandle, _size );
+#endif
+}
+
+} // namespace gl3d::detail
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace detail {
+
+std::atomic<bool> g_profilerEnabled = false;
+std::chrono::steady_clock::time_point g_profilerTimeOffset = std::chrono::steady_clock::now();
+
+//---------------------------------------------------------------------------------------------------------------------
+/// @brief Single producer (owning thread), single consumer (profiler::flush) ring buffer
+struct profiler_thread_buffer
+{
+	static constexpr uint32_t capacity = 16384;
+
+	profiler::event events[capacity];
+	std::atomic<uint32_t> head = 0;
+	std::atomic<uint32_t> tail = 0;
+	std::atomic<uint32_t> dropped = 0;
+	unsigned thread_id = 0;
+};
+
+std::mutex g_profilerMutex;
+std::vector<std::shared_ptr<profiler_thread_buffer>> g_profilerBuffers;
+std::deque<profiler::event> g_profilerEvents; // Oldest events are popped in front once history is full
+
+thread_local profiler_thread_buffer *tl_profilerBuffer = nullptr;
+thread_local unsigned tl_profilerDepth = 0;
+
+//---------------------------------------------------------------------------------------------------------------------
+uint64_t profiler_now()
+{
+	auto elapsed = std::chrono::steady_clock::now() - g_profilerTimeOffset;
+	return static_cast<uint64_t>( std::chrono::duration_cast<std::chrono::nanoseconds>( elapsed ).count() );
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+void profiler_zone::begin( const char *name )
+{
+	_name = name;
+	_start = profiler_now();
+	++tl_profilerDepth;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+void profiler_zone::end()
+{
+	auto endTime = profiler_now();
+	auto depth = --tl_profilerDepth;
+
+	// Buffers are registered once per thread, mutex is never touched afterwards
+	if ( !tl_profilerBuffer )
+	{
+		auto buffer = std::make_shared<profiler_thread_buffer>();
+
+		std::scoped_lock lock( g_profilerMutex );
+		buffer->thread_id = static_cast<unsigned>( g_profilerBuffers.size() );
+		g_profilerBuffers.push_back( buffer );
+		tl_profilerBuffer = buffer.get();
+	}
+
+	auto &buffer = *tl_profilerBuffer;
+	auto head = buffer.head.load( std::memory_order_relaxed );
+	if ( head - buffer.tail.load( std::memory_order_acquire ) >= profiler_thread_buffer::capacity )
+	{
+		buffer.dropped.fetch_add( 1, std::memory_order_relaxed );
+		return;
+	}
+
+	buffer.events[head % profiler_thread_buffer::capacity] = { _name, _start, endTime, buffer.thread_id, depth };
+	buffer.head.store( head + 1, std::memory_order_release );
+}
+
+} // namespace gl3d::detail
+
+//---------------------------------------------------------------------------------------------------------------------
+void profiler::enable( bool enabled )
+{
+	detail::g_profilerEnabled.store( enabled, std::memory_order_relaxed );
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+void profiler::flush()
+{
+	std::scoped_lock lock( detail::g_profilerMutex );
+
+	auto &history = detail::g_profilerEvents;
+	unsigned dropped = 0;
+
+	for ( auto &buffer : detail::g_profilerBuffers )
+	{
+		auto tail = buffer->tail.load( std::memory_order_relaxed );
+		auto head = buffer->head.load( std::memory_order_acquire );
+
+		for ( ; tail != head; ++tail )
+			history.push_back( buffer->events[tail % detail::profiler_thread_buffer::capacity] );
+
+		buffer->tail.store( tail, std::memory_order_release );
+		dropped += buffer->dropped.exchange( 0, std::memory_order_relaxed );
+	}
+
+	while ( history.size() > max_events )
+		history.pop_front();
+
+	if ( dropped )
+		log::warning( "Profiler dropped %u events, flush more often", dropped );
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+std::vector<profiler::event> profiler::events()
+{
+	std::scoped_lock lock( detail::g_profilerMutex );
+	return { detail::g_profilerEvents.begin(), detail::g_profilerEvents.end() };
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+void profiler::clear()
+{
+	std::scoped_lock lock( detail::g_profilerMutex );
+	detail::g_profilerEvents.clear();
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+bool profiler::export_chrome_trace( const std::filesystem::path &path )
+{
+	std::ofstream ofs( path, std::ios_base::out | std::ios_base::trunc );
+	if ( !ofs.is_open() )
+	{
+		log::error( "Could not open file: %s", path.string().c_str() );
+		return false;
+	}
+
+	std::scoped_lock lock( detail::g_profilerMutex );
+
+	ofs << "{\"traceEvents\":[";
+
+	char text[128];
+	bool first = true;
+	for ( auto &e : detail::g_profilerEvents )
+	{
+		ofs << ( first ? "\n" : ",\n" ) << "{\"name\":\"";
+		first = false;
+
+		for ( auto ch = e.name; *ch; ++ch )
+		{
+			if ( *ch == '"' || *ch == '\\' )
+				ofs << '\\';
+
+			ofs << *ch;
+		}
+
+		// Timestamps are in microseconds
+		snprintf( text, sizeof( text ), "\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f", e.start_ns / 1000.0, ( e.end_ns - e.start_ns ) / 1000.0 );
+		ofs << text << ",\"pid\":0,\"tid\":" << e.thread_id << "}";
+	}
+
+	ofs << "\n]}\n";
+	return ofs.good();
+}
+
 } // namespace gl3d
 
 #undef GL3D_FORMAT_LOG_TEXT
@@ -1,8 +1,29 @@
 #pragma once
 
+#include <cmath>
+#include <cstring>
+
 // *INDENT-OFF*
 namespace gl3d::detail {
 
+template <class T> struct xvec2;
+template <class T> struct xvec3;
+
+} // namespace gl3d::detail
+
+namespace gl3d {
+
+/* Forward declarations of helpers used by the templates below */
+template <class T> T normalize(const T &vec);
+template <class TA, class TB> auto cross(const detail::xvec3<TA> &a, const detail::xvec3<TB> &b);
+template <size_t I, class T> detail::xvec2<T> cross_over(const detail::xvec2<T> &a, const detail::xvec2<T> &b);
+template <size_t I, class T> detail::xvec3<T> cross_over(const detail::xvec3<T> &a, const detail::xvec3<T> &b);
+template <class T> T radians(T degrees);
+
+} // namespace gl3d
+
+namespace gl3d::detail {
+
 //---------------------------------------------------------------------------------------------------------------------
 template <typename T, size_t Dimensions> struct xmath_traits
 { using elem_type = T; static constexpr size_t dimensions = Dimensions; };
@@ -16,8 +37,10 @@ template <typename T> struct xvec_data<T, 4> : xmath_traits<T, 4> { union { stru
 //---------------------------------------------------------------------------------------------------------------------
 template <typename T, size_t Dimensions> struct xvec_impl : xvec_data<T, Dimensions>
 {
-	T &operator[](size_t index) { return &x + index; }
-	const T &operator[](size_t index) const { return &x + index; }
+	using xvec_data<T, Dimensions>::data;
+
+	T &operator[](size_t index) { return data[index]; }
+	const T &operator[](size_t index) const { return data[index]; }
 
 	template <typename... Args> xvec_impl(Args&&... args) { static_assert(sizeof...(Args) == Dimensions, ""); set<0>(args...); }
 
@@ -28,6 +51,9 @@ template <typename T, size_t Dimensions> struct xvec_impl : xvec_data<T, Dimensi
 //---------------------------------------------------------------------------------------------------------------------
 template <class T> struct xvec2 : xvec_impl<T, 2>
 {
+	using xvec_impl = detail::xvec_impl<T, 2>;
+	using xvec_impl::data; using xvec_impl::x; using xvec_impl::y;
+
 	xvec2() : xvec_impl(0, 0) { }
 	template <class TX, class TY> xvec2(TX x, TY y) : xvec_impl((T)x, (T)y) { }
 	template <class TV> xvec2(const xvec2<TV> &v): xvec_impl((T)v.x, (T)v.y) { }
@@ -43,14 +69,17 @@ template <class T> struct xvec2 : xvec_impl<T, 2>
 	T length_sq() const { return x*x + y*y; }
 	T length() const { return sqrt(length_sq()); }
 
-	static constexpr xvec2 &unit_x() { static xvec2 v(1, 0); return v; }
-	static constexpr xvec2 &unit_y() { static xvec2 v(0, 1); return v; }
-	static constexpr xvec2 &one()    { static xvec2 v(1, 1); return v; }
+	static const xvec2 &unit_x() { static xvec2 v(1, 0); return v; }
+	static const xvec2 &unit_y() { static xvec2 v(0, 1); return v; }
+	static const xvec2 &one()    { static xvec2 v(1, 1); return v; }
 };
 
 //---------------------------------------------------------------------------------------------------------------------
 template <class T> struct xvec3 : xvec_impl<T, 3>
 {
+	using xvec_impl = detail::xvec_impl<T, 3>;
+	using xvec_impl::data; using xvec_impl::x; using xvec_impl::y; using xvec_impl::z;
+
 	xvec3() : xvec_impl(0, 0, 0) { }
 	template <class TX, class TY, class TZ> xvec3(TX x, TY y, TZ z): xvec_impl((T)x, (T)y, (T)z) { }
 	template <class TV> xvec3(const xvec3<TV> &v) : xvec_impl((T)v.x, (T)v.y, (T)v.z) { }
@@ -67,15 +96,18 @@ template <class T> struct xvec3 : xvec_impl<T, 3>
 	T length_sq() const { return x*x + y*y + z*z; }
 	T length() const { return T(sqrt(length_sq())); }
 
-	static constexpr xvec3 &unit_x() { static xvec3 v(1, 0, 0); return v; }
-	static constexpr xvec3 &unit_y() { static xvec3 v(0, 1, 0); return v; }
-	static constexpr xvec3 &unit_z() { static xvec3 v(0, 0, 1); return v; }
-	static constexpr xvec3 &one()    { static xvec3 v(1, 1, 1); return v; }
+	static const xvec3 &unit_x() { static xvec3 v(1, 0, 0); return v; }
+	static const xvec3 &unit_y() { static xvec3 v(0, 1, 0); return v; }
+	static const xvec3 &unit_z() { static xvec3 v(0, 0, 1); return v; }
+	static const xvec3 &one()    { static xvec3 v(1, 1, 1); return v; }
 };
 
 //---------------------------------------------------------------------------------------------------------------------
 template <class T> struct xvec4 : xvec_impl<T, 4>
 {
+	using xvec_impl = detail::xvec_impl<T, 4>;
+	using xvec_impl::data; using xvec_impl::x; using xvec_impl::y; using xvec_impl::z; using xvec_impl::w;
+
 	xvec4() : xvec_impl(0, 0, 0, 0) { }
 	template <class TX, class TY, class TZ, class TW> xvec4(TX x, TY y, TZ z, TW w): xvec_impl((T)x, (T)y, (T)z, (T)w) { }
 	template <class TV> xvec4(const xvec4<TV> &v): xvec_impl((T)v.x, (T)v.y, (T)v.z, (T)v.w) { }
@@ -98,14 +130,14 @@ template <class T> struct xvec4 : xvec_impl<T, 4>
 	T length_sq() const { return x*x + y*y + z*z + w*w; }
 	T length() const { return sqrt(length_sq()); }
 
-	static constexpr xvec4 &unit_x() { static xvec4 v(1, 0, 0, 0); return v; }
-	static constexpr xvec4 &unit_y() { static xvec4 v(0, 1, 0, 0); return v; }
-	static constexpr xvec4 &unit_z() { static xvec4 v(0, 0, 1, 0); return v; }
-	static constexpr xvec4 &unit_w() { static xvec4 v(0, 0, 0, 1); return v; }
-	static constexpr xvec4 &one()    { static xvec4 v(1, 1, 1, 1); return v; }
-	static constexpr xvec4 &red()    { static xvec4 v(1, 0, 0, 1); return v; }
-	static constexpr xvec4 &green()  { static xvec4 v(0, 1, 0, 1); return v; }
-	static constexpr xvec4 &blue()   { static xvec4 v(0, 0, 1, 1); return v; }
+	static const xvec4 &unit_x() { static xvec4 v(1, 0, 0, 0); return v; }
+	static const xvec4 &unit_y() { static xvec4 v(0, 1, 0, 0); return v; }
+	static const xvec4 &unit_z() { static xvec4 v(0, 0, 1, 0); return v; }
+	static const xvec4 &unit_w() { static xvec4 v(0, 0, 0, 1); return v; }
+	static const xvec4 &one()    { static xvec4 v(1, 1, 1, 1); return v; }
+	static const xvec4 &red()    { static xvec4 v(1, 0, 0, 1); return v; }
+	static const xvec4 &green()  { static xvec4 v(0, 1, 0, 1); return v; }
+	static const xvec4 &blue()   { static xvec4 v(0, 0, 1, 1); return v; }
 };
 
 //---------------------------------------------------------------------------------------------------------------------
@@ -144,7 +176,7 @@ template <class TV> struct basic_xbox
 
 //---------------------------------------------------------------------------------------------------------------------
 template <class TV> using xbox2 = basic_xbox<TV>;
-template <typename TV> struct xbox3 : basic_xbox<TV> { elem_type depth() const { return max.z - min.z; } };
+template <typename TV> struct xbox3 : basic_xbox<TV> { typename TV::elem_type depth() const { return this->max.z - this->min.z; } };
 
 //---------------------------------------------------------------------------------------------------------------------
 template <class T, size_t Dimensions> struct xmat_data : xmath_traits<T, Dimensions>
@@ -157,6 +189,8 @@ template <class T, size_t Dimensions> struct xmat_data : xmath_traits<T, Dimensi
 //---------------------------------------------------------------------------------------------------------------------
 template <class T> struct xmat3 : xmat_data<T, 3>
 {
+	using xmat_data<T, 3>::m; using xmat_data<T, 3>::dimensions;
+
 	xmat3()
 	{
 		m[0] = m[4] = m[8] = static_cast<T>(1);
@@ -200,6 +234,8 @@ template <class T> struct xmat3 : xmat_data<T, 3>
 //---------------------------------------------------------------------------------------------------------------------
 template <typename T> struct xmat4 : xmat_data<T, 4>
 {
+	using xmat_data<T, 4>::m; using xmat_data<T, 4>::dimensions;
+
 	xmat4()
 	{
 		m[0] = m[5] = m[10] = m[15] = static_cast<T>(1);
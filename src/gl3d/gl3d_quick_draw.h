@@ -36,6 +36,13 @@ struct GL3D_API font
 
 enum class sorting_mode { none = 0, front_to_back, back_to_front };
 
+namespace detail {
+
+enum class debug_shape { box, box_filled, sphere, sphere_filled, cylinder, cylinder_filled, cone_filled, line, axes, __count };
+GL3D_ENUM_PLUS( debug_shape )
+
+} // namespace gl3d::detail
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 class GL3D_API quick_draw
@@ -51,6 +58,19 @@ public:
 
 	void render( cmd_queue::ptr queue, const mat4 &view, const mat4 &proj );
 
+	/// @brief Vertices & indices are written straight into persistently mapped ring of GPU buffers split into
+	/// streaming_frames segments (one per reset), render() only binds the segment and fences it, no copies are made
+	/// @note Context sharing objects with the rendering one has to be current while building meshes
+	void streaming( bool enable );
+	bool streaming() const { return _streaming; }
+
+	static constexpr unsigned streaming_frames = 3;
+
+	/// @brief Orders draw calls by view depth of their vertex centroids before render(), stable for equal depths.
+	/// Draw calls are then merged only after sorting, so sorted draws batch less.
+	void sorting( sorting_mode mode ) { _sortingMode = mode; }
+	sorting_mode sorting() const { return _sortingMode; }
+
 	void push_transform();
 
 	void push_transform( const mat4 &mult );
@@ -79,10 +99,26 @@ public:
 
 	void uv( const vec2 &texCoord );
 
+	/// @brief Debug shapes are instances of cached unit meshes, drawn after all other geometry with one instanced
+	/// draw per shape type. They use current color & transform and the last state, but are not depth sorted.
 	void draw_aabb( const box3 &aabb, bool filled = false );
 
+	/// @brief Unit cube [-1, 1] transformed by the matrix
+	void draw_obb( const mat4 &transform, bool filled = false );
+
+	void draw_sphere( const vec3 &center, float radius, bool filled = false );
+
+	void draw_capsule( const vec3 &a, const vec3 &b, float radius, bool filled = false );
+
+	/// @param headSize length of the cone at the tip, zero means quarter of the arrow length
+	void draw_arrow( const vec3 &from, const vec3 &to, float headSize = 0.0f );
+
+	/// @brief Edges of NDC cube transformed by inverse of the matrix, e.g. view-projection matrix of a camera
 	void draw_frustum( const mat4 &mat );
 
+	/// @brief X, Y and Z axes of the transform colored red, green and blue (multiplied by current color)
+	void draw_axes( const mat4 &transform, float size = 1.0f );
+
 	void draw_texture( const vec2 &pos, texture::ptr tex, float scale = 1.0f );
 
 	void draw_text( const vec2 &pos, std::string_view text );
@@ -90,6 +126,8 @@ public:
 protected:
 	bool _dirtyBuffers = true;
 	bool _buildingMesh = false;
+	bool _streaming = false;
+	sorting_mode _sortingMode = sorting_mode::none;
 
 	struct state
 	{
@@ -108,13 +146,13 @@ protected:
 		unsigned firstIndex = UINT_MAX;
 		unsigned indexCount = 0;
 		unsigned stateIndex = UINT_MAX;
-		unsigned transformIndex = 0;
+		unsigned transformIndex = 0; // Of the first merged draw, vertices carry their own
+		vec3 center; // Vertex centroid before transformation, sorting key
 
 		bool try_merging_with( const draw_call &dc )
 		{
 			if (
 			    stateIndex != dc.stateIndex ||
-			    transformIndex != dc.transformIndex ||
 			    primitive != dc.primitive ||
 			    ( firstIndex + indexCount ) != dc.firstIndex )
 				return false;
@@ -127,13 +165,22 @@ protected:
 	std::vector<draw_call> _drawCalls;
 
 	draw_call _currentDrawCall;
+	vec3 _centroidSum;
+
+	std::vector<draw_call> _sortedDrawCalls;
+	std::vector<uint32_t> _sortKeys;
+	std::vector<unsigned> _sortOrder;
+	std::vector<unsigned> _sortTemp;
+
+	const std::vector<draw_call> &sort_draw_calls( const mat4 &view );
 
 	struct compact_gpu_vertex
 	{
 		vec4 posColor; // xyz = world position, w = 32bit RGBA color (converted using floatBitsToUint)
 		uvec4 data;    // xy = UV coord, zw = 16bits texture index, 4x 12bits scissor rect.
+		unsigned transform; // Index into _transforms
 
-		GL3D_LAYOUT( 0, &compact_gpu_vertex::posColor, 1, &compact_gpu_vertex::data )
+		GL3D_LAYOUT( 0, &compact_gpu_vertex::posColor, 1, &compact_gpu_vertex::data, 2, &compact_gpu_vertex::transform )
 	};
 
 	float _currentColor;
@@ -141,7 +188,9 @@ protected:
 
 	std::vector<compact_gpu_vertex> _vertices;
 	std::vector<unsigned> _indices;
-	std::vector<mat4> _transforms;
+	std::vector<mat4> _transforms;         // All transforms of the frame, uploaded to storage buffer by render()
+	std::vector<unsigned> _transformStack; // Indices into _transforms
+	buffer::ptr _transformBuffer;
 
 	decltype( _vertices )::iterator _currentVertex;
 	unsigned _startVertex = UINT_MAX;
@@ -152,6 +201,64 @@ protected:
 	buffer::ptr _vertexBuffer;
 	buffer::ptr _indexBuffer;
 	shader::ptr _shader;
+
+	struct stream_ring
+	{
+		buffer::ptr ring;
+		uint8_t *mapped = nullptr;
+		size_t segment_size = 0;
+		size_t cursor = 0; // Bytes written to the current segment
+	};
+
+	stream_ring _streamVertices;
+	stream_ring _streamIndices;
+	fence::ptr _streamFences[streaming_frames];
+	unsigned _streamSegment = 0;
+	bool _streamSegmentReady = false;
+
+	unsigned num_vertices() const;
+	unsigned num_indices() const;
+
+	void acquire_stream_segment();
+	uint8_t *stream_allocate( stream_ring &stream, size_t size );
+
+	unsigned *allocate_indices( unsigned count );
+
+	struct shape_vertex
+	{
+		vec4 posColor; // Same packing as compact_gpu_vertex
+
+		GL3D_LAYOUT( 0, &shape_vertex::posColor )
+	};
+
+	// std430 layout of instance in shape shader
+	struct shape_instance
+	{
+		mat4 transform;
+		unsigned color;
+		unsigned padding[3];
+	};
+
+	struct shape_mesh
+	{
+		gl_enum primitive = gl_enum::NONE;
+		unsigned firstIndex = 0;
+		unsigned indexCount = 0;
+	};
+
+	shape_mesh _shapeMeshes[+detail::debug_shape::__count];
+	std::vector<shape_instance> _shapeInstances[+detail::debug_shape::__count];
+	std::vector<shape_instance> _shapeInstanceData;
+
+	buffer::ptr _shapeVertexBuffer;
+	buffer::ptr _shapeIndexBuffer;
+	buffer::ptr _shapeInstanceBuffer;
+	shader::ptr _shapeShader;
+
+	void create_shape_meshes();
+	void add_shape( detail::debug_shape s, const mat4 &transform );
+	void render_draw_calls( cmd_queue::ptr queue, const mat4 &view, const mat4 &proj );
+	void render_shapes( cmd_queue::ptr queue, const mat4 &view, const mat4 &proj );
 };
 
 } // namespace gl3d
@@ -9,7 +9,64 @@ namespace gl3d {
 namespace detail {
 
 constexpr size_t k_vertexBatchAllocation = 256;
-constexpr size_t k_renderBatchSize = 64;
+constexpr size_t k_streamSegmentAllocation = 4 * 1024 * 1024;
+constexpr unsigned k_shapeSegments = 32;
+constexpr unsigned k_shapeInstanceBinding = 0; // Matches binding of ShapeInstances in the shape shader
+constexpr unsigned k_transformBinding = 1;     // Matches binding of Transforms in the immediate shader
+
+//---------------------------------------------------------------------------------------------------------------------
+/// @brief Stable LSD radix sort, fills order with indices of keys in ascending order
+void radix_sort( const std::vector<uint32_t> &keys, std::vector<unsigned> &order, std::vector<unsigned> &temp )
+{
+	auto count = keys.size();
+	order.resize( count );
+	temp.resize( count );
+
+	for ( unsigned i = 0; i < count; ++i )
+		order[i] = i;
+
+	if ( !count )
+		return;
+
+	for ( unsigned shift = 0; shift < 32; shift += 8 )
+	{
+		size_t histogram[256] = { };
+		for ( auto key : keys )
+			++histogram[( key >> shift ) & 0xFFu];
+
+		// All keys share this digit, the pass would not change anything
+		if ( histogram[( keys[0] >> shift ) & 0xFFu] == count )
+			continue;
+
+		for ( size_t i = 0, offset = 0; i < 256; ++i )
+		{
+			auto digitCount = histogram[i];
+			histogram[i] = offset;
+			offset += digitCount;
+		}
+
+		for ( auto index : order )
+			temp[histogram[( keys[index] >> shift ) & 0xFFu]++] = index;
+
+		order.swap( temp );
+	}
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+mat4 make_shape_basis( const vec3 &origin, const vec3 &axisZ, float radius )
+{
+	// Unit mesh Z axis maps to axisZ, X & Y to any perpendicular axes scaled by radius
+	auto dir = ( axisZ.length_sq() > 0.0f ) ? normalize( axisZ ) : vec3( 0, 0, 1 );
+	auto helper = ( fabsf( dir.z ) < 0.99f ) ? vec3( 0, 0, 1 ) : vec3( 1, 0, 0 );
+	auto x = normalize( cross( helper, dir ) );
+	auto y = cross( dir, x );
+
+	return {
+		x.x * radius, x.y * radius, x.z * radius, 0,
+		y.x * radius, y.y * radius, y.z * radius, 0,
+		axisZ.x, axisZ.y, axisZ.z, 0,
+		origin.x, origin.y, origin.z, 1 };
+}
 
 //---------------------------------------------------------------------------------------------------------------------
 bool is_base64( uint8_t c ) { return ( isalnum( c ) || ( c == '+' ) || ( c == '/' ) ); }
@@ -220,12 +277,11 @@ quick_draw::quick_draw()
 
 	layout (location = 0) in vec4 v_PositionColor;
 	layout (location = 1) in uvec4 v_Data;
-
-	in int gl_BaseInstance;
+	layout (location = 2) in uint v_Transform;
 
 	uniform mat4 u_ProjectionMatrix;
 	uniform mat4 u_ViewMatrix;
-	uniform mat4 u_Transforms[64];
+	layout (std430, binding = 1) readonly buffer Transforms { mat4 u_Transforms[]; };
 
 	out vec4 Color;
 	out vec2 UV;
@@ -233,7 +289,7 @@ quick_draw::quick_draw()
 
 	void main()
 	{
-		mat4 transform = u_Transforms[gl_BaseInstance + gl_InstanceID];
+		mat4 transform = u_Transforms[v_Transform];
 		gl_Position = u_ProjectionMatrix * u_ViewMatrix * transform * vec4(v_PositionColor.xyz, 1);
 		
 		uint c = floatBitsToUint(v_PositionColor.w);
@@ -264,6 +320,54 @@ quick_draw::quick_draw()
 	code->source( s_immediateShader );
 	_shader = shader::create( code );
 
+	static const char *s_shapeShader = R"SHADER_SOURCE(
+#vertex
+
+	layout (location = 0) in vec4 v_PositionColor;
+
+	struct shape_instance
+	{
+		mat4 transform;
+		uint color;
+	};
+
+	layout (std430, binding = 0) readonly buffer ShapeInstances { shape_instance u_Instances[]; };
+
+	uniform mat4 u_ProjectionMatrix;
+	uniform mat4 u_ViewMatrix;
+
+	out vec4 Color;
+
+	vec4 unpack_color(uint c)
+	{
+		return vec4(float(c & 0xFF), float((c >> 8) & 0xFF), float((c >> 16) & 0xFF), float((c >> 24) & 0xFF)) / 255.0;
+	}
+
+	void main()
+	{
+		shape_instance inst = u_Instances[gl_BaseInstance + gl_InstanceID];
+		gl_Position = u_ProjectionMatrix * u_ViewMatrix * inst.transform * vec4(v_PositionColor.xyz, 1);
+		Color = unpack_color(floatBitsToUint(v_PositionColor.w)) * unpack_color(inst.color);
+	}
+
+#fragment
+
+	in vec4 Color;
+
+	out vec4 out_Color;
+
+	void main()
+	{
+		out_Color = Color;
+	}
+	)SHADER_SOURCE";
+
+	auto shapeCode = shader_code::create();
+	shapeCode->source( s_shapeShader );
+	_shapeShader = shader::create( shapeCode );
+
+	create_shape_meshes();
+
 	reset();
 }
 
@@ -284,11 +388,25 @@ void quick_draw::reset()
 	_drawCalls.clear();
 	_indices.clear();
 
+	// Segment written in this frame was fenced by render(), continue with the next one
+	if ( _streamSegmentReady )
+	{
+		_streamSegment = ( _streamSegment + 1 ) % streaming_frames;
+		_streamSegmentReady = false;
+	}
+
+	_streamVertices.cursor = 0;
+	_streamIndices.cursor = 0;
+
 	_vertices.resize( detail::k_vertexBatchAllocation );
 	_currentVertex = _vertices.begin();
 	_startVertex = UINT_MAX;
 
 	_transforms = { mat4() };
+	_transformStack = { 0 };
+
+	for ( auto &instances : _shapeInstances )
+		instances.clear();
 
 	_currentData = { 0, 0, 0, 0 };
 	set_scissors( { 0, 0, 4095, 4095 } );
@@ -304,10 +422,35 @@ void quick_draw::reset()
 //---------------------------------------------------------------------------------------------------------------------
 void quick_draw::render( cmd_queue::ptr queue, const mat4 &view, const mat4 &proj )
 {
-	if ( _drawCalls.empty() )
+	bool hasShapes = false;
+	for ( const auto &instances : _shapeInstances )
+		hasShapes |= !instances.empty();
+
+	if ( _drawCalls.empty() && !hasShapes )
 		return;
 
-	if ( _dirtyBuffers )
+	queue->begin_zone( "quick_draw" );
+
+	if ( !_drawCalls.empty() )
+		render_draw_calls( queue, view, proj );
+
+	if ( hasShapes )
+		render_shapes( queue, view, proj );
+
+	queue->end_zone();
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+void quick_draw::render_draw_calls( cmd_queue::ptr queue, const mat4 &view, const mat4 &proj )
+{
+	const auto &drawCalls = ( _sortingMode == sorting_mode::none ) ? _drawCalls : sort_draw_calls( view );
+
+	if ( _streaming )
+	{
+		queue->bind_vertex_buffer( _streamVertices.ring, compact_gpu_vertex::layout(), _streamSegment * _streamVertices.segment_size );
+		queue->bind_index_buffer( _streamIndices.ring, false, _streamSegment * _streamIndices.segment_size );
+	}
+	else if ( _dirtyBuffers )
 	{
 		if ( !_vertexBuffer )
 			_vertexBuffer = buffer::create( buffer_usage::dynamic_resizable, _vertices );
@@ -333,76 +476,230 @@ void quick_draw::render( cmd_queue::ptr queue, const mat4 &view, const mat4 &pro
 				queue->update_buffer( _indexBuffer, _indices.data(), indicesSize );
 		}
 
-		for ( auto &kvp : _textureIndexMap )
-		{
-			auto tex = kvp.first;
-			_textureHandles[kvp.second] = tex->synchronize();
-		}
-
 		_dirtyBuffers = false;
 	}
 
+	// Touch all textures every frame, so they stay resident
+	for ( auto &kvp : _textureIndexMap )
+	{
+		auto tex = kvp.first;
+		_textureHandles[kvp.second] = tex->synchronize();
+	}
+
 	queue->bind_shader( _shader );
-	queue->bind_vertex_buffer( _vertexBuffer, compact_gpu_vertex::layout() );
-	queue->bind_index_buffer( _indexBuffer );
+
+	if ( !_streaming )
+	{
+		queue->bind_vertex_buffer( _vertexBuffer, compact_gpu_vertex::layout() );
+		queue->bind_index_buffer( _indexBuffer );
+	}
+
 	queue->set_uniform( "u_ProjectionMatrix", proj );
 	queue->set_uniform( "u_ViewMatrix", view );
 	queue->set_uniform( "u_Textures", _textureHandles );
 
-	unsigned currentStateIndex = UINT_MAX;
-	mat4 transforms[detail::k_renderBatchSize];
+	// Whole transform table at once, vertices index it directly
+	auto transformsSize = _transforms.size() * sizeof( mat4 );
 
-	size_t start = 0;
-	while ( start < _drawCalls.size() )
-	{
-		size_t end = minimum( start + detail::k_renderBatchSize, _drawCalls.size() );
-		auto count = end - start;
+	if ( !_transformBuffer )
+		_transformBuffer = buffer::create( buffer_usage::dynamic_resizable, _transforms );
+	else if ( transformsSize > _transformBuffer->size() )
+		queue->resize_buffer( _transformBuffer, _transforms.data(), transformsSize );
+	else
+		queue->update_buffer( _transformBuffer, _transforms.data(), transformsSize );
 
-		for ( size_t i = 0; i < count; ++i )
+	queue->bind_storage_buffer( _transformBuffer, detail::k_transformBinding );
+
+	unsigned currentStateIndex = UINT_MAX;
+	for ( const auto &dc : drawCalls )
+	{
+		if ( dc.stateIndex != currentStateIndex )
 		{
-			auto id = _drawCalls[start + i].transformIndex;
-			transforms[i] = _transforms[id];
+			currentStateIndex = dc.stateIndex;
+			const auto &state = _states[currentStateIndex];
+			queue->set_state( state.ds );
+			queue->set_state( state.rs );
 		}
 
-		queue->set_uniform( "u_Transforms", transforms, count );
+		queue->draw_indexed( dc.primitive, dc.firstIndex, dc.indexCount );
+	}
 
-		for ( size_t i = start, instanceID = 0; i < end; ++i, ++instanceID )
-		{
-			const auto &dc = _drawCalls[i];
-			if ( dc.stateIndex != currentStateIndex )
-			{
-				currentStateIndex = dc.stateIndex;
-				const auto &state = _states[currentStateIndex];
-				queue->set_state( state.ds );
-				queue->set_state( state.rs );
-			}
+	if ( _streaming )
+		queue->insert_fence( _streamFences[_streamSegment] );
+}
 
-			queue->draw_indexed( dc.primitive, dc.firstIndex, dc.indexCount, 1, instanceID );
-		}
+//---------------------------------------------------------------------------------------------------------------------
+void quick_draw::render_shapes( cmd_queue::ptr queue, const mat4 &view, const mat4 &proj )
+{
+	// All shape types share one instance buffer, each is drawn with its own base instance
+	unsigned baseInstances[+detail::debug_shape::__count];
 
-		start += detail::k_renderBatchSize;
+	_shapeInstanceData.clear();
+	for ( size_t i = 0; i < +detail::debug_shape::__count; ++i )
+	{
+		baseInstances[i] = static_cast<unsigned>( _shapeInstanceData.size() );
+		_shapeInstanceData.insert( _shapeInstanceData.end(), _shapeInstances[i].begin(), _shapeInstances[i].end() );
+	}
+
+	auto instancesSize = _shapeInstanceData.size() * sizeof( shape_instance );
+
+	if ( !_shapeInstanceBuffer )
+		_shapeInstanceBuffer = buffer::create( buffer_usage::dynamic_resizable, _shapeInstanceData );
+	else if ( instancesSize > _shapeInstanceBuffer->size() )
+		queue->resize_buffer( _shapeInstanceBuffer, _shapeInstanceData.data(), instancesSize );
+	else
+		queue->update_buffer( _shapeInstanceBuffer, _shapeInstanceData.data(), instancesSize );
+
+	queue->bind_shader( _shapeShader );
+	queue->bind_vertex_buffer( _shapeVertexBuffer, shape_vertex::layout() );
+	queue->bind_index_buffer( _shapeIndexBuffer );
+	queue->bind_storage_buffer( _shapeInstanceBuffer, detail::k_shapeInstanceBinding );
+	queue->set_uniform( "u_ProjectionMatrix", proj );
+	queue->set_uniform( "u_ViewMatrix", view );
+
+	const auto &state = _states.back();
+	queue->set_state( state.ds );
+	queue->set_state( state.rs );
+
+	for ( size_t i = 0; i < +detail::debug_shape::__count; ++i )
+	{
+		if ( _shapeInstances[i].empty() )
+			continue;
+
+		const auto &mesh = _shapeMeshes[i];
+		queue->draw_indexed( mesh.primitive, mesh.firstIndex, mesh.indexCount, _shapeInstances[i].size(), baseInstances[i] );
 	}
 }
 
+//---------------------------------------------------------------------------------------------------------------------
+const std::vector<quick_draw::draw_call> &quick_draw::sort_draw_calls( const mat4 &view )
+{
+	_sortKeys.resize( _drawCalls.size() );
+
+	for ( size_t i = 0; i < _drawCalls.size(); ++i )
+	{
+		const auto &dc = _drawCalls[i];
+		auto center = _transforms[dc.transformIndex] * dc.center;
+
+		// Camera looks down -Z in view space
+		float depth = -( view[2] * center.x + view[6] * center.y + view[10] * center.z + view[14] );
+
+		// Float bits flipped to unsigned order, negative values sort reversed otherwise
+		uint32_t key;
+		memcpy( &key, &depth, 4 );
+		key ^= ( key & 0x80000000u ) ? 0xFFFFFFFFu : 0x80000000u;
+
+		_sortKeys[i] = ( _sortingMode == sorting_mode::back_to_front ) ? ~key : key;
+	}
+
+	detail::radix_sort( _sortKeys, _sortOrder, _sortTemp );
+
+	_sortedDrawCalls.clear();
+	for ( auto index : _sortOrder )
+	{
+		if ( _sortedDrawCalls.empty() || !_sortedDrawCalls.back().try_merging_with( _drawCalls[index] ) )
+			_sortedDrawCalls.push_back( _drawCalls[index] );
+	}
+
+	return _sortedDrawCalls;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+void quick_draw::streaming( bool enable )
+{
+	assert( !building_mesh() );
+
+	if ( enable == _streaming )
+		return;
+
+	_streaming = enable;
+	_streamVertices = stream_ring();
+	_streamIndices = stream_ring();
+	_streamSegmentReady = false;
+
+	reset();
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+unsigned quick_draw::num_vertices() const
+{
+	if ( _streaming )
+		return static_cast<unsigned>( _streamVertices.cursor / sizeof( compact_gpu_vertex ) );
+
+	return static_cast<unsigned>( _currentVertex - _vertices.begin() );
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+unsigned quick_draw::num_indices() const
+{
+	if ( _streaming )
+		return static_cast<unsigned>( _streamIndices.cursor / sizeof( unsigned ) );
+
+	return static_cast<unsigned>( _indices.size() );
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+void quick_draw::acquire_stream_segment()
+{
+	auto &segmentFence = _streamFences[_streamSegment];
+
+	// GPU should be done with a segment written streaming_frames ago, blocking here means it is way behind
+	if ( !segmentFence )
+		segmentFence = fence::create();
+	else if ( !segmentFence->signaled() )
+		segmentFence->wait();
+
+	_streamSegmentReady = true;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+uint8_t *quick_draw::stream_allocate( stream_ring &stream, size_t size )
+{
+	if ( stream.cursor + size > stream.segment_size )
+	{
+		// New ring has free segments only, data written so far in this frame moves over, the old ring stays alive
+		// as long as commands in flight reference it
+		auto segmentSize = align_up( maximum( stream.segment_size * 2, stream.cursor + size, detail::k_streamSegmentAllocation ), size_t( 256 ) );
+
+		auto ring = buffer::create( buffer_usage::persistent_coherent, nullptr, segmentSize * streaming_frames );
+		ring->synchronize();
+		auto mapped = static_cast<uint8_t *>( ring->map() );
+
+		if ( stream.cursor )
+			memcpy( mapped + _streamSegment * segmentSize, stream.mapped + _streamSegment * stream.segment_size, stream.cursor );
+
+		stream.ring = ring;
+		stream.mapped = mapped;
+		stream.segment_size = segmentSize;
+	}
+
+	auto result = stream.mapped + _streamSegment * stream.segment_size + stream.cursor;
+	stream.cursor += size;
+	return result;
+}
+
 //---------------------------------------------------------------------------------------------------------------------
 void quick_draw::push_transform()
 {
 	assert( !building_mesh() );
-	_transforms.push_back( _transforms.back() );
+	_transformStack.push_back( _transformStack.back() );
 }
 
 //---------------------------------------------------------------------------------------------------------------------
 void quick_draw::push_transform( const mat4 &mult )
 {
 	assert( !building_mesh() );
-	_transforms.push_back( _transforms.back() * mult );
+
+	// Never overwritten, draws recorded with previous entries still refer to them
+	_transformStack.push_back( static_cast<unsigned>( _transforms.size() ) );
+	_transforms.push_back( _transforms[_transformStack[_transformStack.size() - 2]] * mult );
 }
 
 //---------------------------------------------------------------------------------------------------------------------
 void quick_draw::pop_transform()
 {
-	assert( !building_mesh() && _transforms.size() > 1 ); // There should always remain 1 matrix on the stack (identity)
-	_transforms.pop_back();
+	assert( !building_mesh() && _transformStack.size() > 1 ); // There should always remain 1 matrix on the stack (identity)
+	_transformStack.pop_back();
 }
 
 //---------------------------------------------------------------------------------------------------------------------
@@ -459,12 +756,17 @@ void quick_draw::begin( gl_enum primitiveType )
 	assert( !building_mesh() );
 
 	_currentDrawCall.primitive = primitiveType;
-	_currentDrawCall.firstIndex = static_cast<unsigned>( _indices.size() );
+	_currentDrawCall.firstIndex = num_indices();
 	_currentDrawCall.indexCount = 0;
 	_currentDrawCall.stateIndex = static_cast<unsigned>( _states.size() - 1 );
+	_currentDrawCall.transformIndex = _transformStack.back();
+
+	if ( _streaming && !_streamSegmentReady )
+		acquire_stream_segment();
 
 	_buildingMesh = true;
-	_startVertex = static_cast<unsigned>( _currentVertex - _vertices.begin() );
+	_startVertex = num_vertices();
+	_centroidSum = vec3();
 }
 
 //---------------------------------------------------------------------------------------------------------------------
@@ -473,7 +775,7 @@ void quick_draw::end()
 	assert( building_mesh() );
 	_buildingMesh = false;
 
-	auto numVertices = static_cast<unsigned>( _currentVertex - _vertices.begin() ) - _startVertex;
+	auto numVertices = num_vertices() - _startVertex;
 	if ( !numVertices )
 		return;
 
@@ -484,8 +786,7 @@ void quick_draw::end()
 			assert( ( numVertices % 2 ) == 0 );
 			_currentDrawCall.indexCount = numVertices;
 
-			_indices.resize( _indices.size() + numVertices );
-			for ( unsigned i = 0, *index = _indices.data() + _currentDrawCall.firstIndex, v = _startVertex; i < numVertices; ++i )
+			for ( unsigned i = 0, *index = allocate_indices( numVertices ), v = _startVertex; i < numVertices; ++i )
 				*index++ = v++;
 		}
 		break;
@@ -497,8 +798,7 @@ void quick_draw::end()
 			assert( ( numVertices % 4 ) == 0 );
 			_currentDrawCall.indexCount = ( numVertices / 4 ) * 6;
 
-			_indices.resize( _indices.size() + _currentDrawCall.indexCount );
-			for ( unsigned i = 0, *index = _indices.data() + _currentDrawCall.firstIndex, v = _startVertex; i < numVertices; i += 4 )
+			for ( unsigned i = 0, *index = allocate_indices( _currentDrawCall.indexCount ), v = _startVertex; i < numVertices; i += 4 )
 			{
 				*index++ = v;
 				*index++ = v + 1;
@@ -514,7 +814,10 @@ void quick_draw::end()
 		break;
 	}
 
-	bool pushDrawCall = _drawCalls.empty() || ( !_drawCalls.back().try_merging_with( _currentDrawCall ) );
+	_currentDrawCall.center = _centroidSum / static_cast<float>( numVertices );
+
+	// Sorted draw calls are merged in render(), their keys would be lost here
+	bool pushDrawCall = _drawCalls.empty() || _sortingMode != sorting_mode::none || ( !_drawCalls.back().try_merging_with( _currentDrawCall ) );
 	if ( pushDrawCall )
 		_drawCalls.push_back( _currentDrawCall );
 
@@ -527,15 +830,37 @@ void quick_draw::vertex( const vec3 &pos )
 {
 	assert( building_mesh() );
 
-	if ( _currentVertex == _vertices.end() )
+	compact_gpu_vertex *v = nullptr;
+
+	if ( _streaming )
+		v = reinterpret_cast<compact_gpu_vertex *>( stream_allocate( _streamVertices, sizeof( compact_gpu_vertex ) ) );
+	else
 	{
-		_vertices.resize( _vertices.size() + detail::k_vertexBatchAllocation );
-		_currentVertex = _vertices.end() - detail::k_vertexBatchAllocation;
+		if ( _currentVertex == _vertices.end() )
+		{
+			_vertices.resize( _vertices.size() + detail::k_vertexBatchAllocation );
+			_currentVertex = _vertices.end() - detail::k_vertexBatchAllocation;
+		}
+
+		v = &*_currentVertex++;
 	}
 
-	_currentVertex->posColor = vec4( pos.x, pos.y, pos.z, _currentColor );
-	_currentVertex->data = _currentData;
-	++_currentVertex;
+	// Written front to back in one go, mapped memory may be write-combined
+	v->posColor = vec4( pos.x, pos.y, pos.z, _currentColor );
+	v->data = _currentData;
+	v->transform = _transformStack.back();
+
+	_centroidSum = _centroidSum + pos;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+unsigned *quick_draw::allocate_indices( unsigned count )
+{
+	if ( _streaming )
+		return reinterpret_cast<unsigned *>( stream_allocate( _streamIndices, count * sizeof( unsigned ) ) );
+
+	_indices.resize( _indices.size() + count );
+	return _indices.data() + _indices.size() - count;
 }
 
 //---------------------------------------------------------------------------------------------------------------------
@@ -556,24 +881,263 @@ void quick_draw::uv( const vec2 &texCoord )
 }
 
 //---------------------------------------------------------------------------------------------------------------------
-void quick_draw::draw_aabb( const box3 &aabb, bool filled )
+void quick_draw::create_shape_meshes()
 {
-	if ( filled )
+	using detail::debug_shape;
+
+	std::vector<shape_vertex> vertices;
+	std::vector<unsigned> indices;
+
+	auto vertex = [&]( const vec3 &pos, unsigned color = 0xFFFFFFFFu )
 	{
+		float packedColor;
+		memcpy( &packedColor, &color, 4 );
+		vertices.push_back( { vec4( pos.x, pos.y, pos.z, packedColor ) } );
+		return static_cast<unsigned>( vertices.size() - 1 );
+	};
+
+	auto line = [&]( unsigned a, unsigned b ) { indices.insert( indices.end(), { a, b } ); };
+
+	// Generated counter-clockwise from outside, front faces are clockwise by default (rasterizer_state::front_ccw)
+	auto triangle = [&]( unsigned a, unsigned b, unsigned c ) { indices.insert( indices.end(), { a, c, b } ); };
+
+	auto begin_shape = [&]( debug_shape s, gl_enum primitive )
+	{
+		_shapeMeshes[+s].primitive = primitive;
+		_shapeMeshes[+s].firstIndex = static_cast<unsigned>( indices.size() );
+	};
+
+	auto end_shape = [&]( debug_shape s )
+	{
+		_shapeMeshes[+s].indexCount = static_cast<unsigned>( indices.size() ) - _shapeMeshes[+s].firstIndex;
+	};
+
+	// Circle of unit radius in plane of axes u & v, returns index of the first vertex
+	auto circle = [&]( unsigned u, unsigned v, float w )
+	{
+		unsigned first = static_cast<unsigned>( vertices.size() );
+		for ( unsigned i = 0; i < detail::k_shapeSegments; ++i )
+		{
+			float angle = two_pi * i / detail::k_shapeSegments;
+			vec3 pos( 0, 0, 0 );
+			pos[u] = cosf( angle );
+			pos[v] = sinf( angle );
+			pos[3 - u - v] = w;
+			vertex( pos );
+		}
+
+		return first;
+	};
 
+	auto circle_lines = [&]( unsigned first )
+	{
+		for ( unsigned i = 0; i < detail::k_shapeSegments; ++i )
+			line( first + i, first + ( i + 1 ) % detail::k_shapeSegments );
+	};
+
+	// Box [-1, 1]
+	begin_shape( debug_shape::box, gl_enum::LINES );
+	{
+		unsigned first = static_cast<unsigned>( vertices.size() );
+		for ( unsigned i = 0; i < 8; ++i )
+			vertex( { ( i & 1 ) ? 1.0f : -1.0f, ( i & 2 ) ? 1.0f : -1.0f, ( i & 4 ) ? 1.0f : -1.0f } );
+
+		// Edges connect corners differing in one coordinate
+		for ( unsigned i = 0; i < 8; ++i )
+			for ( unsigned bit = 1; bit < 8; bit <<= 1 )
+				if ( !( i & bit ) )
+					line( first + i, first + ( i | bit ) );
 	}
-	else
+	end_shape( debug_shape::box );
+
+	begin_shape( debug_shape::box_filled, gl_enum::TRIANGLES );
+	for ( unsigned axis = 0; axis < 3; ++axis )
 	{
-		begin( gl_enum::LINES );
+		unsigned u = ( axis + 1 ) % 3, v = ( axis + 2 ) % 3;
+
+		for ( float sign : { -1.0f, 1.0f } )
+		{
+			unsigned first = static_cast<unsigned>( vertices.size() );
+			const float corners[4][2] = { { -1, -1 }, { 1, -1 }, { 1, 1 }, { -1, 1 } };
+
+			for ( auto &c : corners )
+			{
+				vec3 pos;
+				pos[axis] = sign;
+				pos[u] = c[0];
+				pos[v] = c[1];
+				vertex( pos );
+			}
 
-		end();
+			// u x v = axis, corners go counter-clockwise seen from +axis
+			if ( sign > 0 )
+			{
+				triangle( first, first + 1, first + 2 );
+				triangle( first, first + 2, first + 3 );
+			}
+			else
+			{
+				triangle( first, first + 2, first + 1 );
+				triangle( first, first + 3, first + 2 );
+			}
+		}
 	}
+	end_shape( debug_shape::box_filled );
+
+	// Sphere of unit radius, three great circles
+	begin_shape( debug_shape::sphere, gl_enum::LINES );
+	circle_lines( circle( 0, 1, 0.0f ) );
+	circle_lines( circle( 0, 2, 0.0f ) );
+	circle_lines( circle( 1, 2, 0.0f ) );
+	end_shape( debug_shape::sphere );
+
+	begin_shape( debug_shape::sphere_filled, gl_enum::TRIANGLES );
+	{
+		const unsigned stacks = detail::k_shapeSegments / 2, slices = detail::k_shapeSegments;
+		unsigned first = static_cast<unsigned>( vertices.size() );
+
+		for ( unsigned i = 0; i <= stacks; ++i )
+		{
+			float theta = pi * i / stacks;
+			for ( unsigned j = 0; j <= slices; ++j )
+			{
+				float phi = two_pi * j / slices;
+				vertex( { sinf( theta ) * cosf( phi ), sinf( theta ) * sinf( phi ), cosf( theta ) } );
+			}
+		}
+
+		for ( unsigned i = 0; i < stacks; ++i )
+		{
+			for ( unsigned j = 0; j < slices; ++j )
+			{
+				unsigned a = first + i * ( slices + 1 ) + j, b = a + slices + 1;
+				triangle( a, b, a + 1 );
+				triangle( a + 1, b, b + 1 );
+			}
+		}
+	}
+	end_shape( debug_shape::sphere_filled );
+
+	// Cylinder of unit radius along Z, from 0 to 1
+	begin_shape( debug_shape::cylinder, gl_enum::LINES );
+	{
+		unsigned bottom = circle( 0, 1, 0.0f ), top = circle( 0, 1, 1.0f );
+		circle_lines( bottom );
+		circle_lines( top );
+
+		for ( unsigned i = 0; i < detail::k_shapeSegments; i += detail::k_shapeSegments / 4 )
+			line( bottom + i, top + i );
+	}
+	end_shape( debug_shape::cylinder );
+
+	begin_shape( debug_shape::cylinder_filled, gl_enum::TRIANGLES );
+	{
+		unsigned bottom = circle( 0, 1, 0.0f ), top = circle( 0, 1, 1.0f );
+		unsigned bottomCenter = vertex( { 0, 0, 0 } ), topCenter = vertex( { 0, 0, 1 } );
+
+		for ( unsigned i = 0; i < detail::k_shapeSegments; ++i )
+		{
+			unsigned next = ( i + 1 ) % detail::k_shapeSegments;
+			triangle( bottom + i, bottom + next, top + i );
+			triangle( bottom + next, top + next, top + i );
+			triangle( bottomCenter, bottom + next, bottom + i );
+			triangle( topCenter, top + i, top + next );
+		}
+	}
+	end_shape( debug_shape::cylinder_filled );
+
+	// Cone with unit radius base at Z = 0 and apex at Z = 1
+	begin_shape( debug_shape::cone_filled, gl_enum::TRIANGLES );
+	{
+		unsigned base = circle( 0, 1, 0.0f );
+		unsigned baseCenter = vertex( { 0, 0, 0 } ), apex = vertex( { 0, 0, 1 } );
+
+		for ( unsigned i = 0; i < detail::k_shapeSegments; ++i )
+		{
+			unsigned next = ( i + 1 ) % detail::k_shapeSegments;
+			triangle( base + i, base + next, apex );
+			triangle( baseCenter, base + next, base + i );
+		}
+	}
+	end_shape( debug_shape::cone_filled );
+
+	begin_shape( debug_shape::line, gl_enum::LINES );
+	line( vertex( { 0, 0, 0 } ), vertex( { 0, 0, 1 } ) );
+	end_shape( debug_shape::line );
+
+	begin_shape( debug_shape::axes, gl_enum::LINES );
+	line( vertex( { 0, 0, 0 }, 0xFF0000FFu ), vertex( { 1, 0, 0 }, 0xFF0000FFu ) );
+	line( vertex( { 0, 0, 0 }, 0xFF00FF00u ), vertex( { 0, 1, 0 }, 0xFF00FF00u ) );
+	line( vertex( { 0, 0, 0 }, 0xFFFF0000u ), vertex( { 0, 0, 1 }, 0xFFFF0000u ) );
+	end_shape( debug_shape::axes );
+
+	_shapeVertexBuffer = buffer::create( buffer_usage::immutable, vertices );
+	_shapeIndexBuffer = buffer::create( buffer_usage::immutable, indices );
 }
 
 //---------------------------------------------------------------------------------------------------------------------
-void quick_draw::draw_frustum( const mat4 &worldProj )
+void quick_draw::add_shape( detail::debug_shape s, const mat4 &transform )
 {
+	assert( !building_mesh() );
+
+	auto &instance = _shapeInstances[+s].emplace_back();
+	instance.transform = _transforms[_transformStack.back()] * transform;
+	memcpy( &instance.color, &_currentColor, 4 );
+}
 
+//---------------------------------------------------------------------------------------------------------------------
+void quick_draw::draw_aabb( const box3 &aabb, bool filled )
+{
+	draw_obb( mat4::make_translation( ( aabb.min + aabb.max ) * 0.5f ) * mat4::make_scale( ( aabb.max - aabb.min ) * 0.5f ), filled );
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+void quick_draw::draw_obb( const mat4 &transform, bool filled )
+{
+	add_shape( filled ? detail::debug_shape::box_filled : detail::debug_shape::box, transform );
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+void quick_draw::draw_sphere( const vec3 &center, float radius, bool filled )
+{
+	add_shape( filled ? detail::debug_shape::sphere_filled : detail::debug_shape::sphere,
+	           mat4::make_translation( center ) * mat4::make_scale( radius ) );
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+void quick_draw::draw_capsule( const vec3 &a, const vec3 &b, float radius, bool filled )
+{
+	draw_sphere( a, radius, filled );
+	draw_sphere( b, radius, filled );
+	add_shape( filled ? detail::debug_shape::cylinder_filled : detail::debug_shape::cylinder, detail::make_shape_basis( a, b - a, radius ) );
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+void quick_draw::draw_arrow( const vec3 &from, const vec3 &to, float headSize )
+{
+	auto dir = to - from;
+	auto length = dir.length();
+	if ( length <= 0.0f )
+		return;
+
+	float headLength = ( headSize > 0.0f ) ? minimum( headSize, length ) : length * 0.25f;
+	auto headStart = from + dir * ( ( length - headLength ) / length );
+
+	add_shape( detail::debug_shape::line, detail::make_shape_basis( from, headStart - from, 1.0f ) );
+	add_shape( detail::debug_shape::cone_filled, detail::make_shape_basis( headStart, to - headStart, headLength * 0.35f ) );
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+void quick_draw::draw_frustum( const mat4 &mat )
+{
+	// Homogeneous transformation, the shader does not divide by w before projection
+	add_shape( detail::debug_shape::box, mat4::make_inverse( mat ) );
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+void quick_draw::draw_axes( const mat4 &transform, float size )
+{
+	add_shape( detail::debug_shape::axes, transform * mat4::make_scale( size ) );
 }
 
 //---------------------------------------------------------------------------------------------------------------------
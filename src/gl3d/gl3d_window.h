@@ -11,6 +11,8 @@
 
 namespace gl3d {
 
+namespace detail { struct render_thread; }
+
 GL3D_API extern const unsigned &frame_id;
 GL3D_API extern const float &time;
 GL3D_API extern const float &delta;
@@ -19,6 +21,44 @@ GL3D_API void run();
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+//---------------------------------------------------------------------------------------------------------------------
+/// @brief Frame pacing statistics collected by run() over a rolling window of recent frames
+struct GL3D_API frame_stats
+{
+	/// @brief Number of most recent frames kept for percentiles & histogram
+	static constexpr size_t window_size = 1024;
+
+	/// @brief Histogram bucket width in milliseconds, last bucket collects all longer frames
+	static constexpr float bucket_ms = 0.25f;
+	static constexpr size_t bucket_count = 200;
+
+	/// @brief Frame time (in milliseconds) below which fraction p (0..1) of recent frames fall
+	static float percentile( float p );
+	static float p50() { return percentile( 0.50f ); }
+	static float p95() { return percentile( 0.95f ); }
+	static float p99() { return percentile( 0.99f ); }
+
+	/// @brief Last measured frame time in milliseconds
+	static float last();
+
+	/// @brief Number of frames in the rolling window
+	static size_t count();
+
+	/// @brief Frame time histogram of the rolling window, bucket i covers [i * bucket_ms, (i + 1) * bucket_ms)
+	static std::vector<unsigned> histogram();
+
+	/// @brief Frames which finished their work after the fps_limit deadline, counted since last reset
+	static unsigned missed_deadlines();
+
+	/// @brief Time before a deadline which the limiter spends spinning instead of sleeping, 2 ms by default
+	static float spin_threshold();
+	static void spin_threshold( float milliseconds );
+
+	static void reset();
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
 //---------------------------------------------------------------------------------------------------------------------
 enum class window_flag
 {
@@ -26,6 +66,13 @@ enum class window_flag
 	resizable  = 0b00000001,
 	fullscreen = 0b00000010,
 	borderless = 0b00000100,
+
+	// Window is painted & presented on its own thread with a context sharing resources with other windows. Paint
+	// events of all such windows run in parallel, run() waits for them before next on_tick but not for presentation.
+	// Window context must be used only from its paint event, on_tick runs with a separate main thread context.
+	// Only textures, samplers & render target pool are synchronized between render threads. Threaded windows must
+	// not share shaders, buffers or quick_draw instances, uniforms are program state shared by all contexts.
+	render_thread = 0b00001000,
 };
 
 GL3D_ENUM_PLUS( window_flag )
@@ -52,16 +99,19 @@ public:
 
 	bool closed() const { return _native_handle == nullptr; }
 
+	/// @brief True if window is painted & presented on its own render thread, see window_flag::render_thread
+	bool threaded() const { return _renderThread != nullptr; }
+
 	void title( std::string_view text );
 	const std::string &title() const { return _title; }
 
 	void adjust( uvec2 size, ivec2 pos );
 
-	void size( uvec2 size ) { adjust( _pos, size ); }
+	void size( uvec2 size ) { adjust( size, _pos ); }
 	uvec2 size() const { return _size; }
 	float aspect_ratio() const { return static_cast<float>( _size.x ) / _size.y; }
 
-	void position( ivec2 pos ) { adjust( pos, _size ); }
+	void position( ivec2 pos ) { adjust( _size, pos ); }
 	ivec2 position() const { return _pos; }
 
 	void close();
@@ -80,6 +130,7 @@ protected:
 	void *_native_handle = nullptr;
 	detail::context::ptr _context;
 	quick_draw::ptr _qd;
+	std::unique_ptr<detail::render_thread> _renderThread;
 	std::string _title;
 	ivec2 _pos;
 	uvec2 _size;
@@ -117,8 +168,11 @@ GL3D_API extern detail::callback_chain<bool( window_event & )> on_window_event;
 #ifdef GL3D_IMPLEMENTATION
 	#ifndef __GL3D_WIN32_H_IMPL__
 		#define __GL3D_WIN32_H_IMPL__
+		#include "gl3d_window.inl"
 		#if defined(WIN32)
 			#include "gl3d_window_win32.inl"
+		#elif defined(__linux__)
+			#include "gl3d_window_egl.inl"
 		#endif
 	#endif // __GL3D_WIN32_H_IMPL__
 #endif // GL2D_IMPLEMENTATION
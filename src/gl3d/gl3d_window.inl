@@ -0,0 +1,231 @@
+#ifndef __GL3D_WIN32_H_IMPL__
+	#define __GL3D_WIN32_H_IMPL__
+#endif
+
+#include "gl3d_window.h"
+
+#include <algorithm>
+#include <chrono>
+
+#if defined(_MSC_VER)
+	#include <intrin.h>
+#endif
+
+namespace gl3d {
+
+namespace detail {
+
+unsigned g_frame_id = 0;
+float g_time = 0.0f;
+float g_delta = 0.0f;
+
+std::mutex g_frameStatsMutex;
+float g_frameTimes[frame_stats::window_size] = { };
+size_t g_frameTimeCursor = 0;
+size_t g_frameTimeCount = 0;
+unsigned g_frameHistogram[frame_stats::bucket_count] = { };
+unsigned g_missedDeadlines = 0;
+std::chrono::steady_clock::duration g_spinThreshold = std::chrono::milliseconds( 2 );
+
+} // namespace gl3d::detail
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+//---------------------------------------------------------------------------------------------------------------------
+const unsigned &frame_id = detail::g_frame_id;
+const float &time = detail::g_time;
+const float &delta = detail::g_delta;
+unsigned fps_limit = 0;
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace detail {
+
+//---------------------------------------------------------------------------------------------------------------------
+void record_frame_time( std::chrono::steady_clock::duration frameTime )
+{
+	float ms = std::chrono::duration<float, std::milli>( frameTime ).count();
+	auto bucketOf = []( float t )
+	{
+		return minimum( static_cast<size_t>( t / frame_stats::bucket_ms ), frame_stats::bucket_count - 1 );
+	};
+
+	std::scoped_lock lock( g_frameStatsMutex );
+	if ( g_frameTimeCount == frame_stats::window_size )
+		--g_frameHistogram[bucketOf( g_frameTimes[g_frameTimeCursor] )];
+	else
+		++g_frameTimeCount;
+
+	g_frameTimes[g_frameTimeCursor] = ms;
+	++g_frameHistogram[bucketOf( ms )];
+	g_frameTimeCursor = ( g_frameTimeCursor + 1 ) % frame_stats::window_size;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+void record_missed_deadline()
+{
+	std::scoped_lock lock( g_frameStatsMutex );
+	++g_missedDeadlines;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+inline void spin_pause()
+{
+#if defined(_MSC_VER)
+	_mm_pause();
+#elif defined(__i386__) || defined(__x86_64__)
+	__builtin_ia32_pause();
+#else
+	std::this_thread::yield();
+#endif
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+void wait_until( std::chrono::steady_clock::time_point deadline )
+{
+	std::chrono::steady_clock::duration spinThreshold;
+	{
+		std::scoped_lock lock( g_frameStatsMutex );
+		spinThreshold = g_spinThreshold;
+	}
+
+	// Sleep overshoots by up to a timer period, so only sleep while the deadline is further away than that...
+	while ( true )
+	{
+		auto remaining = deadline - std::chrono::steady_clock::now();
+		if ( remaining <= spinThreshold )
+			break;
+
+		std::this_thread::sleep_for( remaining - spinThreshold );
+	}
+
+	// ...and spin the rest of the way
+	while ( std::chrono::steady_clock::now() < deadline )
+		spin_pause();
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+void limit_frame_rate( std::chrono::steady_clock::time_point &deadline )
+{
+	using clock = std::chrono::steady_clock;
+
+	if ( !fps_limit )
+	{
+		deadline = clock::now();
+		return;
+	}
+
+	// Deadline is carried over from the previous frame instead of being measured from the frame start, so the
+	// sleep overshoot does not accumulate into a lower average frame rate
+	deadline += std::chrono::duration_cast<clock::duration>( std::chrono::nanoseconds( 1000000000ull / fps_limit ) );
+
+	auto now = clock::now();
+	if ( now > deadline )
+	{
+		record_missed_deadline();
+
+		// Do not try to catch up with a burst of short frames, start pacing again from now
+		deadline = now;
+	}
+	else
+		wait_until( deadline );
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+void paint_window( window *w )
+{
+	auto ctx = w->context();
+	ctx->make_current( w->size() );
+	glViewport( 0, 0, w->size().x, w->size().y );
+
+	{
+		GL3D_PROFILE_ZONE( "on_window_event (paint)" );
+		on_window_event( window_event( window_event::type::paint, w->id() ) );
+	}
+
+	auto projMatrix = mat4::make_ortho( 0, float( w->size().x ), float( w->size().y ), 0, -1, 1 );
+
+	auto qd = w->quick_draw();
+	qd->render( ctx, mat4(), projMatrix );
+	qd->reset();
+}
+
+} // namespace gl3d::detail
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+//---------------------------------------------------------------------------------------------------------------------
+float frame_stats::percentile( float p )
+{
+	std::vector<float> frameTimes;
+	{
+		std::scoped_lock lock( detail::g_frameStatsMutex );
+		frameTimes.assign( detail::g_frameTimes, detail::g_frameTimes + detail::g_frameTimeCount );
+	}
+
+	if ( frameTimes.empty() )
+		return 0.0f;
+
+	p = p < 0.0f ? 0.0f : ( p > 1.0f ? 1.0f : p );
+	auto nth = frameTimes.begin() + static_cast<size_t>( p * ( frameTimes.size() - 1 ) + 0.5f );
+	std::nth_element( frameTimes.begin(), nth, frameTimes.end() );
+	return *nth;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+float frame_stats::last()
+{
+	std::scoped_lock lock( detail::g_frameStatsMutex );
+	if ( !detail::g_frameTimeCount )
+		return 0.0f;
+
+	return detail::g_frameTimes[( detail::g_frameTimeCursor + window_size - 1 ) % window_size];
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+size_t frame_stats::count()
+{
+	std::scoped_lock lock( detail::g_frameStatsMutex );
+	return detail::g_frameTimeCount;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+std::vector<unsigned> frame_stats::histogram()
+{
+	std::scoped_lock lock( detail::g_frameStatsMutex );
+	return std::vector<unsigned>( detail::g_frameHistogram, detail::g_frameHistogram + bucket_count );
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+unsigned frame_stats::missed_deadlines()
+{
+	std::scoped_lock lock( detail::g_frameStatsMutex );
+	return detail::g_missedDeadlines;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+float frame_stats::spin_threshold()
+{
+	std::scoped_lock lock( detail::g_frameStatsMutex );
+	return std::chrono::duration<float, std::milli>( detail::g_spinThreshold ).count();
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+void frame_stats::spin_threshold( float milliseconds )
+{
+	std::scoped_lock lock( detail::g_frameStatsMutex );
+	auto threshold = std::chrono::duration<float, std::milli>( maximum( milliseconds, 0.0f ) );
+	detail::g_spinThreshold = std::chrono::duration_cast<std::chrono::steady_clock::duration>( threshold );
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+void frame_stats::reset()
+{
+	std::scoped_lock lock( detail::g_frameStatsMutex );
+	detail::g_frameTimeCursor = 0;
+	detail::g_frameTimeCount = 0;
+	detail::g_missedDeadlines = 0;
+	std::fill( std::begin( detail::g_frameHistogram ), std::end( detail::g_frameHistogram ), 0u );
+}
+
+} // namespace gl3d
@@ -0,0 +1,259 @@
+#ifndef __GL3D_WIN32_H_IMPL__
+	#define __GL3D_WIN32_H_IMPL__
+#endif
+
+#include "gl3d_window.h"
+
+#include <chrono>
+
+namespace gl3d {
+
+decltype( on_window_event ) on_window_event;
+
+namespace detail {
+
+bool g_should_quit = false;
+unsigned g_next_window_id = 0;
+
+std::chrono::steady_clock::time_point g_timer_offset;
+std::chrono::steady_clock::time_point g_last_timer;
+
+std::vector<window::ptr> g_windows;
+
+// Headless windows are always painted serially on the main thread
+struct render_thread { };
+
+//---------------------------------------------------------------------------------------------------------------------
+struct window_impl
+{
+	static void resize_surface( window *w, uvec2 size );
+};
+
+//---------------------------------------------------------------------------------------------------------------------
+void window_impl::resize_surface( window *w, uvec2 size )
+{
+	auto surface = create_pbuffer_surface( size );
+	if ( surface == EGL_NO_SURFACE )
+		return;
+
+	w->_context->window_native_handle( surface );
+	destroy_pbuffer_surface( w->_native_handle );
+	w->_native_handle = surface;
+	w->_size = size;
+}
+
+} // namespace gl3d::detail
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+//---------------------------------------------------------------------------------------------------------------------
+window::ptr window::create( std::string_view title, uvec2 size, ivec2 pos, unsigned flags )
+{
+	if ( size.x <= 0 )
+		size.x = 1920;
+
+	if ( size.y <= 0 )
+		size.y = 1080;
+
+	if ( pos.x == INT_MAX )
+		pos.x = 0;
+
+	if ( pos.y == INT_MAX )
+		pos.y = 0;
+
+	if ( flags & +window_flag::render_thread )
+		log::warning( "Headless window '%.*s' is painted on the main thread", static_cast<int>( title.length() ), title.data() );
+
+	auto surface = detail::create_pbuffer_surface( size );
+	if ( surface == EGL_NO_SURFACE )
+		return nullptr;
+
+	auto context = std::make_shared<detail::context>(
+	                   surface,
+	                   detail::g_windows.empty()
+	                   ? nullptr
+	                   : detail::g_windows.front()->context() );
+
+	if ( !context->native_handle() )
+	{
+		detail::destroy_pbuffer_surface( surface );
+		return nullptr;
+	}
+
+	auto &result = detail::g_windows.emplace_back( std::make_shared<window>() );
+
+	result->_flags = flags & ~+window_flag::render_thread;
+	result->_id = detail::g_next_window_id++;
+	result->_native_handle = surface;
+	result->_context = context;
+	result->_qd = std::make_shared<gl3d::quick_draw>();
+	result->_title = title;
+	result->_pos = pos;
+	result->_size = size;
+
+	on_window_event( window_event( window_event::type::open, result->_id ) );
+	return result;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+window::ptr window::from_id( unsigned id )
+{
+	for ( const auto &w : detail::g_windows )
+		if ( w->_id == id )
+			return w;
+
+	return nullptr;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+window::~window()
+{
+	_qd.reset();
+	_context.reset();
+	detail::destroy_pbuffer_surface( _native_handle );
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+void window::title( std::string_view text )
+{
+	_title = text;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+void window::adjust( uvec2 size, ivec2 pos )
+{
+	if ( closed() )
+		return;
+
+	if ( pos != _pos )
+	{
+		_pos = pos;
+
+		window_event e( window_event::type::move, _id );
+		e.move = _pos;
+		on_window_event( e );
+	}
+
+	if ( size != _size )
+	{
+		detail::window_impl::resize_surface( this, size );
+
+		window_event e( window_event::type::resize, _id );
+		e.resize = _size;
+		on_window_event( e );
+	}
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+void window::close()
+{
+	if ( !_native_handle )
+		return;
+
+	for ( size_t i = 0; i < detail::g_windows.size(); ++i )
+	{
+		if ( detail::g_windows[i].get() == this )
+		{
+			on_window_event( window_event( window_event::type::close, _id ) );
+
+			_context.reset();
+			detail::destroy_pbuffer_surface( _native_handle );
+			_native_handle = nullptr;
+
+			detail::g_windows.erase( detail::g_windows.begin() + i );
+			detail::g_should_quit |= ( _id == 0 ) || detail::g_windows.empty();
+			return;
+		}
+	}
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+void window::present()
+{
+	// Swapping a pbuffer has no effect, just make sure the frame gets submitted
+	glFlush();
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+void window::fullscreen( bool set )
+{
+	_fullscreen = set;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace detail {
+
+//---------------------------------------------------------------------------------------------------------------------
+void update()
+{
+	GL3D_PROFILE_ZONE( "update" );
+
+	auto now = std::chrono::steady_clock::now();
+
+	++detail::g_frame_id;
+	detail::g_time = std::chrono::duration<float>( now - g_timer_offset ).count();
+	detail::g_delta = std::chrono::duration<float>( now - g_last_timer ).count();
+	g_last_timer = now;
+
+	if ( auto w = window::from_id( 0 ); w != nullptr )
+	{
+		auto ctx = w->context();
+		ctx->make_current( w->size() );
+		glViewport( 0, 0, w->size().x, w->size().y );
+	}
+
+	{
+		GL3D_PROFILE_ZONE( "on_tick" );
+		on_tick();
+	}
+
+	// Copy, windows can be closed from event handlers
+	auto windows = g_windows;
+
+	for ( const auto &w : windows )
+	{
+		if ( w->closed() )
+			continue;
+
+		paint_window( w.get() );
+
+		w->present();
+		w->context()->reset();
+		w->context()->next_frame();
+	}
+
+	texture_residency::next_frame();
+	render_target_pool::next_frame();
+	profiler::flush();
+}
+
+} // namespace gl3d::detail
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+//---------------------------------------------------------------------------------------------------------------------
+void run()
+{
+	detail::g_timer_offset = detail::g_last_timer = std::chrono::steady_clock::now();
+
+	using clock = std::chrono::steady_clock;
+	auto deadline = clock::now();
+	auto lastFrameStart = clock::time_point();
+
+	// There are no messages to wait for, loop ends when the first or the last window gets closed
+	while ( !detail::g_should_quit && !detail::g_windows.empty() )
+	{
+		auto frameStart = clock::now();
+		if ( lastFrameStart != clock::time_point() )
+			detail::record_frame_time( frameStart - lastFrameStart );
+		lastFrameStart = frameStart;
+
+		detail::update();
+
+		GL3D_PROFILE_ZONE( "run: frame limiter" );
+		detail::limit_frame_rate( deadline );
+	}
+}
+
+} // namespace gl3d
@@ -14,16 +14,19 @@
 
 #include <windows.h>
 #include <windowsx.h>
+#include <mmsystem.h>
 #include <hidsdi.h>
 #include <Xinput.h>
 #include <shellapi.h>
 
 #include <chrono>
 #include <codecvt>
+#include <condition_variable>
 #include <locale>
 
 #pragma comment(lib, "hid.lib")
 #pragma comment(lib, "xinput.lib")
+#pragma comment(lib, "winmm.lib")
 
 #define GL3D_WINDOW_CLASS "gl3d_window"
 
@@ -41,10 +44,6 @@ uint64_t g_timer_frequency = 0;
 uint64_t g_last_timer_counter = 0;
 size_t g_mouseCaptureCount = 0;
 
-unsigned g_frame_id = 0;
-float g_time = 0.0f;
-float g_delta = 0.0f;
-
 std::vector<window::ptr> g_windows;
 std::map<int, unsigned> g_xinputPortMap;
 
@@ -64,8 +63,28 @@ std::map<HANDLE, std::unique_ptr<raw_gamepad_info>> g_rawGamepadInfoMap;
 struct window_impl
 {
 	static LRESULT CALLBACK wnd_proc( HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam );
+
+	static void start_render_thread( window *w );
+	static void stop_render_thread( window *w );
+	static void render_thread_proc( window *w );
+	static void request_frame( window *w );
+	static void wait_for_paint( window *w );
+};
+
+//---------------------------------------------------------------------------------------------------------------------
+struct render_thread
+{
+	std::thread thread;
+	std::mutex mutex;
+	std::condition_variable cv;
+	unsigned requested_frame = 0;
+	unsigned painted_frame = 0;
+	bool quit = false;
 };
 
+// Context current on the main thread during on_tick when the first window renders on its own thread
+context::ptr g_mainContext;
+
 //---------------------------------------------------------------------------------------------------------------------
 struct window_class
 {
@@ -189,6 +208,10 @@ window::ptr window::create( std::string_view title, uvec2 size, ivec2 pos, unsig
 	DragAcceptFiles( handle, TRUE );
 
 	on_window_event( window_event( window_event::type::open, result->_id ) );
+
+	if ( flags & +window_flag::render_thread )
+		detail::window_impl::start_render_thread( result.get() );
+
 	return result;
 }
 
@@ -205,6 +228,7 @@ window::ptr window::from_id( unsigned id )
 //---------------------------------------------------------------------------------------------------------------------
 window::~window()
 {
+	detail::window_impl::stop_render_thread( this );
 	_qd.reset();
 	_context.reset();
 	DestroyWindow( HWND( _native_handle ) );
@@ -258,6 +282,7 @@ void window::close()
 		{
 			on_window_event( window_event( window_event::type::close, _id ) );
 
+			detail::window_impl::stop_render_thread( this );
 			_context.reset();
 			DestroyWindow( HWND( _native_handle ) );
 			_native_handle = nullptr;
@@ -330,6 +355,8 @@ namespace detail {
 //---------------------------------------------------------------------------------------------------------------------
 void update_xinput()
 {
+	GL3D_PROFILE_ZONE( "update_xinput" );
+
 	for ( int i = 0; i < XUSER_MAX_COUNT; ++i )
 	{
 		auto iter = g_xinputPortMap.find( i );
@@ -379,9 +406,110 @@ void update_xinput()
 	}
 }
 
+//---------------------------------------------------------------------------------------------------------------------
+void window_impl::start_render_thread( window *w )
+{
+	// Main thread needs its own context for on_tick, window contexts are current on their render threads
+	if ( !g_mainContext && w->_id == 0 )
+		g_mainContext = std::make_shared<context>( w->_context );
+
+	w->_renderThread = std::make_unique<render_thread>();
+	w->_renderThread->requested_frame = w->_renderThread->painted_frame = g_frame_id;
+	w->_renderThread->thread = std::thread( render_thread_proc, w );
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+void window_impl::stop_render_thread( window *w )
+{
+	auto rt = w->_renderThread.get();
+	if ( !rt )
+		return;
+
+	assert( rt->thread.get_id() != std::this_thread::get_id() );
+
+	{
+		std::scoped_lock lock( rt->mutex );
+		rt->quit = true;
+		rt->cv.notify_all();
+	}
+
+	rt->thread.join();
+	w->_renderThread.reset();
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+void window_impl::request_frame( window *w )
+{
+	if ( auto rt = w->_renderThread.get(); rt != nullptr )
+	{
+		std::scoped_lock lock( rt->mutex );
+		rt->requested_frame = g_frame_id;
+		rt->cv.notify_all();
+	}
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+void window_impl::wait_for_paint( window *w )
+{
+	if ( auto rt = w->_renderThread.get(); rt != nullptr )
+	{
+		std::unique_lock<std::mutex> lock( rt->mutex );
+		rt->cv.wait( lock, [rt]() { return rt->painted_frame == rt->requested_frame; } );
+	}
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+void window_impl::render_thread_proc( window *w )
+{
+	auto rt = w->_renderThread.get();
+	auto ctx = w->_context;
+	unsigned frame = rt->painted_frame;
+
+	while ( true )
+	{
+		{
+			std::unique_lock<std::mutex> lock( rt->mutex );
+			rt->cv.wait( lock, [&]() { return rt->quit || rt->requested_frame != frame; } );
+
+			if ( rt->quit )
+				break;
+
+			frame = rt->requested_frame;
+		}
+
+		{
+			GL3D_PROFILE_ZONE( "render thread: paint" );
+			paint_window( w );
+
+			// Main thread recycles render targets and updates shared buffers once the paint is signalled,
+			// commands reading them have to reach the server first
+			glFlush();
+		}
+
+		{
+			std::scoped_lock lock( rt->mutex );
+			rt->painted_frame = frame;
+			rt->cv.notify_all();
+		}
+
+		{
+			GL3D_PROFILE_ZONE( "render thread: present" );
+			w->present();
+		}
+
+		ctx->reset();
+		ctx->next_frame();
+	}
+
+	// Context has to be released before it can be deleted by the main thread
+	wglMakeCurrent( nullptr, nullptr );
+}
+
 //---------------------------------------------------------------------------------------------------------------------
 void update()
 {
+	GL3D_PROFILE_ZONE( "update" );
+
 	LARGE_INTEGER li;
 	QueryPerformanceCounter( &li );
 	li.QuadPart -= g_timer_offset;
@@ -395,30 +523,61 @@ void update()
 
 	if ( auto w = window::from_id( 0 ); w != nullptr )
 	{
-		auto ctx = w->context();
+		auto ctx = w->threaded() ? g_mainContext : w->context();
 		ctx->make_current( w->size() );
 		glViewport( 0, 0, w->size().x, w->size().y );
 	}
 
-	on_tick();
+	{
+		GL3D_PROFILE_ZONE( "on_tick" );
+		on_tick();
+	}
 
+	bool anyThreaded = false;
 	for ( const auto &w : g_windows )
+		anyThreaded |= w->threaded();
+
+	if ( anyThreaded )
 	{
-		auto ctx = w->context();
-		ctx->make_current( w->size() );
-		glViewport( 0, 0, w->size().x, w->size().y );
+		// Objects created or updated during on_tick have to reach the server before other contexts use them
+		glFlush();
 
-		on_window_event( window_event( window_event::type::paint, w->id() ) );
+		for ( const auto &w : g_windows )
+			window_impl::request_frame( w.get() );
+	}
 
-		auto projMatrix = mat4::make_ortho( 0, float( w->size().x ), float( w->size().y ), 0, -1, 1 );
+	for ( const auto &w : g_windows )
+	{
+		if ( w->threaded() )
+			continue;
 
-		auto qd = w->quick_draw();
-		qd->render( ctx, mat4(), projMatrix );
-		qd->reset();
+		paint_window( w.get() );
 
 		w->present();
-		ctx->reset();
+		w->context()->reset();
+		w->context()->next_frame();
+	}
+
+	if ( anyThreaded )
+	{
+		GL3D_PROFILE_ZONE( "update: wait for render threads" );
+
+		// Paint events read state written by on_tick, presentation may still overlap with the next frame
+		for ( const auto &w : g_windows )
+			window_impl::wait_for_paint( w.get() );
 	}
+
+	// Main context ran on_tick, it needs the same per-frame housekeeping as window contexts
+	if ( auto w = window::from_id( 0 ); w != nullptr && w->threaded() )
+	{
+		g_mainContext->make_current( w->size() );
+		g_mainContext->reset();
+		g_mainContext->next_frame();
+	}
+
+	texture_residency::next_frame();
+	render_target_pool::next_frame();
+	profiler::flush();
 }
 
 //---------------------------------------------------------------------------------------------------------------------
@@ -573,6 +732,8 @@ void update_raw_input_gamepad( RAWINPUT *raw, raw_gamepad_info &rgi )
 //---------------------------------------------------------------------------------------------------------------------
 void process_raw_input( HRAWINPUT hRawInput )
 {
+	GL3D_PROFILE_ZONE( "process_raw_input" );
+
 	thread_local std::vector<uint8_t> tl_rawInputBuffer;
 
 	UINT bufferSize;
@@ -725,6 +886,8 @@ void init_raw_input_devices()
 //---------------------------------------------------------------------------------------------------------------------
 LRESULT CALLBACK window_impl::wnd_proc( HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam )
 {
+	GL3D_PROFILE_ZONE( "wnd_proc" );
+
 	for ( const auto &w : g_windows )
 	{
 		if ( HWND( w->native_handle() ) == hWnd )
@@ -905,12 +1068,6 @@ LRESULT CALLBACK window_impl::wnd_proc( HWND hWnd, UINT message, WPARAM wParam,
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-//---------------------------------------------------------------------------------------------------------------------
-const unsigned &frame_id = detail::g_frame_id;
-const float &time = detail::g_time;
-const float &delta = detail::g_delta;
-unsigned fps_limit = 0;
-
 //---------------------------------------------------------------------------------------------------------------------
 void run()
 {
@@ -923,17 +1080,29 @@ void run()
 
 	detail::init_raw_input_devices();
 
+	// Raise system timer resolution, so that the coarse sleep of the frame limiter can get close to the deadline
+	timeBeginPeriod( 1 );
+
+	using clock = std::chrono::steady_clock;
+	auto deadline = clock::now();
+	auto lastFrameStart = clock::time_point();
+
 	while ( true )
 	{
-		auto nextFrameMark = std::chrono::high_resolution_clock::now();
-		if ( fps_limit )
-			nextFrameMark += std::chrono::microseconds( 1000000u / fps_limit );
+		auto frameStart = clock::now();
+		if ( lastFrameStart != clock::time_point() )
+			detail::record_frame_time( frameStart - lastFrameStart );
+		lastFrameStart = frameStart;
 
-		MSG msg;
-		while ( PeekMessage( &msg, nullptr, 0, 0, PM_REMOVE ) )
 		{
-			TranslateMessage( &msg );
-			DispatchMessage( &msg );
+			GL3D_PROFILE_ZONE( "run: messages" );
+
+			MSG msg;
+			while ( PeekMessage( &msg, nullptr, 0, 0, PM_REMOVE ) )
+			{
+				TranslateMessage( &msg );
+				DispatchMessage( &msg );
+			}
 		}
 
 		if ( !detail::g_should_quit )
@@ -941,8 +1110,17 @@ void run()
 		else
 			break;
 
-		std::this_thread::sleep_until( nextFrameMark );
+		GL3D_PROFILE_ZONE( "run: frame limiter" );
+		detail::limit_frame_rate( deadline );
 	}
+
+	for ( const auto &w : detail::g_windows )
+		detail::window_impl::stop_render_thread( w.get() );
+
+	// Deleted while the window it was created for still exists, static destruction would come after GL teardown
+	detail::g_mainContext.reset();
+
+	timeEndPeriod( 1 );
 }
 
 } // namespace gl3d
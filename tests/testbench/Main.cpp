@@ -19,6 +19,8 @@ struct FrameData
 {
 	gl3d::mat4 ProjectionMatrix;
 	gl3d::mat4 ViewMatrix;
+
+	GL3D_BLOCK_LAYOUT( std140, "FrameData", "ProjectionMatrix", &FrameData::ProjectionMatrix, "ViewMatrix", &FrameData::ViewMatrix );
 };
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -196,25 +198,37 @@ protected:
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-int main()
+int main( int argc, char *argv[] )
 {
 	using namespace gl3d;
 
+	// Smoke runs quit after given number of frames, headless windows cannot be closed otherwise
+	unsigned maxFrames = 0;
+	for ( int i = 1; i + 1 < argc; ++i )
+	{
+		if ( !strcmp( argv[i], "--frames" ) )
+			maxFrames = static_cast<unsigned>( atoi( argv[i + 1] ) );
+	}
+
 	// Mount folder with example data
 	vfs::mount( "../../data" );
 
+	// Reuse linked shader programs between runs
+	program_cache::directory( "program_cache" );
+
 	fps_limit = 125;
 
+	// Record CPU zones, trace is written on exit
+	profiler::enable( true );
+
 	/*
 	TrueTypeFont ttf;
 	ttf.LoadFromFile( "fonts/OpenSans-Regular.ttf" );
 	ttf.EmitVertices( 16.0f, 0, 0, "Hello, world!" );
 	*/
 
-	window::create( "Main Window", { 1280, 800 } );
-
-	auto rt = texture::create( gl_internal_format::RGBA8, uvec2{ 512, 512 } );
-	auto dt = texture::create( gl_internal_format::DEPTH_COMPONENT32F, uvec2{ rt->width(), rt->height() } );
+	// Painted on its own thread, qd3D is not shared with any other threaded window
+	window::create( "Main Window", { 1280, 800 }, { INT_MAX, INT_MAX }, window::default_flags | +window_flag::render_thread );
 
 	auto qd3D = std::make_shared<quick_draw>();
 
@@ -291,6 +305,9 @@ int main()
 			rot.x = rot.x + g.axis[+gamepad_axis::thumb_right].pos.x * delta * 5.0f;
 			rot.y += g.axis[+gamepad_axis::thumb_right].pos.y;
 		}
+
+		if ( maxFrames && frame_id >= maxFrames )
+			w->close();
 	};
 
 	on_window_event += [&]( window_event & e )->bool
@@ -309,6 +326,10 @@ int main()
 				float y = 2.0f * cos( rot.x );
 				float z = 2.0f + 2.0f * rot.y;
 
+				auto rt = render_target_pool::acquire( gl_internal_format::RGBA8, { 512, 512 } );
+				auto dt = render_target_pool::acquire( gl_internal_format::DEPTH_COMPONENT32F, { rt->width(), rt->height() } );
+
+				ctx->begin_zone( "offscreen" );
 				ctx->bind_render_targets( rt, dt );
 				ctx->clear_color( { 0.4f, 0.2f, 0.1f, 1.0f } );
 				ctx->clear_depth( 1.0f );
@@ -318,6 +339,7 @@ int main()
 				              mat4::make_perspective( 90.0f, rt->aspect_ratio(), 0.01f, 1000.0f ) );
 
 				ctx->unbind_render_targets();
+				ctx->end_zone();
 
 				auto qd = w->quick_draw();
 				qd->draw_texture( { 0, 0 }, rt );
@@ -329,5 +351,7 @@ int main()
 	};
 
 	run();
+
+	profiler::export_chrome_trace( "trace.json" );
 	return 0;
 }